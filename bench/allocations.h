@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made by this process so far, counted at malloc so that operator new and Eigen's
+// allocations are included. Linking allocations.cpp replaces malloc and friends, so it doesn't mix with
+// a sanitizer's allocator.
+uint64_t allocation_count();
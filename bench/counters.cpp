@@ -0,0 +1,10 @@
+#include "counters.h"
+
+void set_counters(benchmark::State& state, int64_t samples_per_op, uint64_t allocations_before) {
+    double allocations_made = static_cast<double>(allocation_count() - allocations_before);
+    state.counters["allocs/op"] = benchmark::Counter(allocations_made, benchmark::Counter::kAvgIterations);
+    if (samples_per_op > 0) {
+        double samples = static_cast<double>(state.iterations() * samples_per_op);
+        state.counters["samples/s"] = benchmark::Counter(samples, benchmark::Counter::kIsRate);
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+
+#include "allocations.h"
+
+// Every benchmark times one block per iteration, so its time is the time per block. On top of that
+// this reports samples/s given the samples in one block (if any), and allocs/op given the allocation
+// count taken just before the timed loop.
+void set_counters(benchmark::State& state, int64_t samples_per_op, uint64_t allocations_before);
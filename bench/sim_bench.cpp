@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <numbers>
+#include <soxrpp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "counters.h"
+#include "decimator.h"
+#include "event_stream.h"
+#include "modal_sim.h"
+#include "sim.h"
+
+namespace {
+
+// What the visualizer configures, see viz/src/main.tsx, but undamped. A long run would otherwise decay
+// into denormals and time those instead.
+SimParams client_params(Integrator integrator) {
+    return {
+        .physics_sample_rate = 1000000,
+        .physics_block_size = 512,
+        .audio_sample_rate = 48000,
+        .audio_block_size = 1024,
+        .viz_sample_rate = 25,
+        .viz_block_size = 1,
+        .mass = 0.15f,
+        .stiffness = 5000.0f,
+        .damping = 0.0f,
+        .area = 1.0f,
+        .integrator = integrator,
+    };
+}
+
+// A decaying tone at the spring's frequency, to feed the DSP stages something like what the sim does
+std::vector<float> ringing_block(size_t size, int sample_rate) {
+    std::vector<float> block(size);
+    for (size_t i = 0; i < size; i++) {
+        double t = static_cast<double>(i) / sample_rate;
+        block[i] = static_cast<float>(std::exp(-0.3 * t) * std::cos(2 * std::numbers::pi * 29.0 * t));
+    }
+    return block;
+}
+
+// One physics block of step() calls per iteration, the per-sample path
+void BM_sim_step(benchmark::State& state) {
+    SimParams params = client_params(Integrator::SemiImplicitEuler);
+    Sim sim(params, {.x = 1.0, .v = 0.0});
+    double dt = 1.0 / params.physics_sample_rate;
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        for (int i = 0; i < params.physics_block_size; i++) {
+            benchmark::DoNotOptimize(sim.step(dt));
+        }
+    }
+    set_counters(state, params.physics_block_size, allocations);
+}
+BENCHMARK(BM_sim_step);
+
+// One physics block per iteration, as the scheduler steps it, including resampling and decimation
+void BM_sim_step_block(benchmark::State& state) {
+    auto integrator = static_cast<Integrator>(state.range(0));
+    Sim sim(client_params(integrator), {.x = 1.0, .v = 0.0});
+    // The exact integrator runs at the audio rate instead
+    const SimParams& params = sim.get_params();
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sim.step_block(params.physics_block_size));
+    }
+    set_counters(state, params.physics_block_size, allocations);
+}
+BENCHMARK(BM_sim_step_block)
+    ->ArgName("integrator")
+    ->Arg(static_cast<int>(Integrator::SemiImplicitEuler))
+    ->Arg(static_cast<int>(Integrator::Exact));
+
+// The viz path of one physics block, a sample at a time
+void BM_decimator_filter(benchmark::State& state) {
+    SimParams params = client_params(Integrator::SemiImplicitEuler);
+    Decimator decimator;
+    decimator.setup(params.physics_sample_rate, params.viz_sample_rate);
+    std::vector<float> block = ringing_block(params.physics_block_size, params.physics_sample_rate);
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        for (float sample : block) {
+            benchmark::DoNotOptimize(decimator.filter(sample));
+        }
+    }
+    set_counters(state, params.physics_block_size, allocations);
+}
+BENCHMARK(BM_decimator_filter);
+
+// The same, a block at a time as step_block() does it
+void BM_decimator_process(benchmark::State& state) {
+    SimParams params = client_params(Integrator::SemiImplicitEuler);
+    Decimator decimator;
+    decimator.setup(params.physics_sample_rate, params.viz_sample_rate);
+    std::vector<float> block = ringing_block(params.physics_block_size, params.physics_sample_rate);
+    std::vector<float> output;
+    output.reserve(block.size());
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        output.clear();
+        decimator.process(block, output);
+        benchmark::DoNotOptimize(output.data());
+    }
+    set_counters(state, params.physics_block_size, allocations);
+}
+BENCHMARK(BM_decimator_process);
+
+// Physics to audio rate conversion of one physics block, as Sim::flush_physics_block() does it
+void BM_soxr_resample(benchmark::State& state) {
+    SimParams params = client_params(Integrator::SemiImplicitEuler);
+    soxrpp::SoxResampler<float, float> resampler(params.physics_sample_rate, params.audio_sample_rate, 1);
+    std::vector<float> block = ringing_block(params.physics_block_size, params.physics_sample_rate);
+    std::vector<float> output(params.audio_block_size);
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        soxrpp::SoxrBuffer<float> ibuf(std::span{block});
+        soxrpp::SoxrBuffer<float> obuf(std::span{output});
+        benchmark::DoNotOptimize(resampler.process(ibuf, obuf));
+    }
+    set_counters(state, params.physics_block_size, allocations);
+}
+BENCHMARK(BM_soxr_resample);
+
+// Filling an audio event and encoding it for the wire, per encoding and transport
+void BM_event_encode(benchmark::State& state) {
+    auto encoding = static_cast<SampleEncoding>(state.range(0));
+    bool binary = state.range(1) != 0;
+    SimParams params = client_params(Integrator::SemiImplicitEuler);
+    std::vector<float> block = ringing_block(params.audio_block_size, params.audio_sample_rate);
+    Event event;
+    std::string out;
+    size_t sample_idx = 0;
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        event.assign(EventType::AudioBlock, block, sample_idx, encoding);
+        if (binary) {
+            event.write_binary(out);
+        } else {
+            event.write_sse(out);
+        }
+        benchmark::DoNotOptimize(out.data());
+        sample_idx += block.size();
+    }
+    set_counters(state, params.audio_block_size, allocations);
+    state.counters["bytes/block"] = static_cast<double>(out.size());
+}
+BENCHMARK(BM_event_encode)
+    ->ArgNames({"encoding", "binary"})
+    ->ArgsProduct({
+        {static_cast<int>(SampleEncoding::F32), static_cast<int>(SampleEncoding::S16),
+         static_cast<int>(SampleEncoding::F16), static_cast<int>(SampleEncoding::Delta)},
+        {0, 1},
+    });
+
+// Streaming one audio block and its share of viz blocks to a client over SSE or the binary endpoint,
+// encoding into the connection's buffer and writing it to a socket as the DataSink does. A thread on
+// the other end drains the socket, the way a client would. Reports wire bytes/s and CPU seconds spent
+// per second of audio streamed, CPU time being this thread's only.
+void BM_stream_transport(benchmark::State& state) {
+    auto encoding = static_cast<SampleEncoding>(state.range(0));
+    bool binary = state.range(1) != 0;
+    SimParams params = client_params(Integrator::SemiImplicitEuler);
+    std::vector<float> audio = ringing_block(params.audio_block_size, params.audio_sample_rate);
+    std::vector<float> viz(params.viz_block_size, 0.5f);
+    // Viz blocks per audio block, at least one
+    int viz_per_audio = std::max(1, params.viz_sample_rate * params.audio_block_size /
+                                        (params.audio_sample_rate * params.viz_block_size));
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    std::vector<char> drained(1 << 16);
+    std::thread reader([fd = fds[1], &drained]() {
+        while (read(fd, drained.data(), drained.size()) > 0) {
+        }
+    });
+
+    Event event;
+    std::string buffer;
+    size_t sample_idx = 0;
+    int64_t bytes = 0;
+    bool failed = false;
+    auto write_event = [&]() {
+        if (binary) {
+            event.write_binary(buffer);
+        } else {
+            event.write_sse(buffer);
+        }
+        for (size_t written = 0; written < buffer.size();) {
+            ssize_t n = write(fds[0], buffer.data() + written, buffer.size() - written);
+            if (n <= 0) {
+                failed = true;
+                return;
+            }
+            written += n;
+        }
+        bytes += buffer.size();
+    };
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        event.assign(EventType::AudioBlock, audio, sample_idx, encoding);
+        write_event();
+        for (int i = 0; i < viz_per_audio; i++) {
+            event.assign(EventType::VizBlock, viz, sample_idx, encoding);
+            write_event();
+        }
+        sample_idx += audio.size();
+    }
+    set_counters(state, params.audio_block_size, allocations);
+
+    close(fds[0]);
+    reader.join();
+    close(fds[1]);
+    if (failed) {
+        state.SkipWithError("write failed");
+        return;
+    }
+    state.SetBytesProcessed(bytes);
+    double audio_seconds = static_cast<double>(state.iterations()) * audio.size() / params.audio_sample_rate;
+    state.counters["cpu_s/audio_s"] =
+        benchmark::Counter(audio_seconds, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+BENCHMARK(BM_stream_transport)
+    ->ArgNames({"encoding", "binary"})
+    ->ArgsProduct({
+        {static_cast<int>(SampleEncoding::F32), static_cast<int>(SampleEncoding::S16),
+         static_cast<int>(SampleEncoding::F16), static_cast<int>(SampleEncoding::Delta)},
+        {0, 1},
+    });
+
+// One audio block of a bank of barely damped modes, so none of them drop out during the run
+void BM_modal_sim_step_block(benchmark::State& state) {
+    size_t mode_count = state.range(0);
+    SimParams params = client_params(Integrator::Exact);
+    ModalParams modes;
+    for (size_t i = 0; i < mode_count; i++) {
+        modes.freq.push_back(100.0 + 15000.0 * i / mode_count);
+        modes.decay.push_back(1e-3);
+        modes.amp.push_back(1.0 / mode_count);
+    }
+    ModalSim sim(params, modes);
+    uint64_t allocations = allocation_count();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sim.step_block(params.audio_block_size));
+    }
+    set_counters(state, params.audio_block_size, allocations);
+}
+BENCHMARK(BM_modal_sim_step_block)->ArgName("modes")->Arg(16)->Arg(256)->Arg(4096);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,67 @@
+// Times getting mesh and modal results out of the addon and onto the wire, as server.js does.
+// Usage: node bench.js <mesh file> [samples per run] [iterations]
+//
+// "boxed" is what the getters used to do (one JS number per element) and "json" is the JSON body
+// served on top of that. "view" and "binary" are the typed array getters and the octet-stream body.
+const bonk = require('./build/Release/Bonk.node')
+
+const [meshFile, samplesArg, iterationsArg] = process.argv.slice(2)
+if (!meshFile) {
+  console.error("usage: node bench.js <mesh file> [samples per run] [iterations]")
+  process.exit(1)
+}
+const samples = Number(samplesArg ?? 48000 * 10)
+const iterations = Number(iterationsArg ?? 20)
+
+const median = (xs) => {
+  const sorted = [...xs].sort((a, b) => a - b)
+  return sorted[Math.floor(sorted.length / 2)]
+}
+
+const time = (fn) => {
+  const times = []
+  let result
+  for (let i = 0; i < iterations; i++) {
+    const start = process.hrtime.bigint()
+    result = fn()
+    times.push(Number(process.hrtime.bigint() - start) / 1e6)
+  }
+  return [median(times), result]
+}
+
+const expect = (what, response) => {
+  if (response != 0 && response != 6) {
+    console.error(`${what} failed with ${response}`)
+    process.exit(1)
+  }
+}
+
+const main = async () => {
+  const instance = new bonk.BonkInstance()
+  expect("loadMesh", await instance.loadMeshAsync(meshFile))
+  expect("prepareThree", await instance.prepareThreeAsync())
+  expect("initModalContext", await instance.initModalContextAsync(1000, 1e9, 1 / 48000))
+  const indices = instance.getIndices()
+  const hit = Uint32Array.from(indices.subarray(0, 3))
+  expect("bonk", instance.bonk(hit, new Float64Array([1, 1, 1]), new Float64Array([0, 0, 1])))
+  expect("runModal", await instance.runModalAsync(samples))
+
+  const getters = [
+    ["indices", () => instance.getIndices()],
+    ["vertices", () => instance.getVertices()],
+    ["results", () => instance.getModalResults()],
+  ]
+  console.log(`${iterations} iterations, median ms`)
+  console.log(["", "elements", "view", "binary", "boxed", "json", "speedup"].join("\t"))
+  for (const [name, get] of getters) {
+    const [viewMs, array] = time(get)
+    const [binaryMs] = time(() => Buffer.from(array.buffer, array.byteOffset, array.byteLength))
+    const [boxedMs, boxed] = time(() => Array.from(array))
+    const [jsonMs] = time(() => JSON.stringify({success: true, data: boxed}))
+    const before = boxedMs + jsonMs
+    const after = viewMs + binaryMs
+    console.log([name, array.length, viewMs, binaryMs, boxedMs, jsonMs].map((v) => typeof v == 'number' && !Number.isInteger(v) ? v.toFixed(3) : v).join("\t") + `\t${(before / after).toFixed(0)}x`)
+  }
+}
+
+main()
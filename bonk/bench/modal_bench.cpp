@@ -0,0 +1,165 @@
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include "counters.h"
+#include "tet.hpp"
+
+// Modal setup and synthesis on a real mesh, with the parameters bench.js uses. Each run points
+// BONK_CACHE_DIR at a scratch directory of its own, so nothing is served from an earlier run's cache.
+
+namespace {
+
+constexpr double DENSITY = 1000;
+constexpr double STIFFNESS = 1e9;
+constexpr double DT = 1.0 / 48000;
+// Samples the streaming server asks for at a time
+constexpr int AUDIO_BLOCK = 1024;
+// Surface vertices one hit spreads over
+constexpr int HIT_VERTICES = 16;
+
+std::filesystem::path cacheDir() {
+  return std::filesystem::temp_directory_path() / "bonk-bench-cache";
+}
+
+// Meshed once and held for the whole run, so every other instance on the mesh finds it in the
+// ModelStore. It never gets a modal context, so it never holds a basis either.
+void keepMesh() {
+  static BonkInstance keeper {};
+  static bool loaded = keeper.loadMesh(BONK_BENCH_MESH) == BonkInstance::BonkResult::Success;
+  if (!loaded) {std::abort();}
+}
+
+// An instance on the mesh with a modal context, which stays in memory while it lives
+std::unique_ptr<BonkInstance> modalInstance(const ModalOptions& options) {
+  keepMesh();
+  auto instance = std::make_unique<BonkInstance>();
+  instance->loadMesh(BONK_BENCH_MESH);
+  if (instance->prepareThree() != BonkInstance::BonkResult::Success || instance->initModalContext(DENSITY, STIFFNESS, DT, 0.05, 0.01, options) != BonkInstance::BonkResult::Success) {
+    std::abort();
+  }
+  return instance;
+}
+
+struct Hit {
+  std::vector<uint32_t> indices {};
+  std::vector<double> weights {};
+};
+
+Hit makeHit(BonkInstance& instance) {
+  Hit hit {};
+  auto indices = instance.getIndices();
+  for (int i = 0; i < HIT_VERTICES && i < static_cast<int>(indices->size()); i++) {
+    hit.indices.push_back((*indices)[i]);
+    hit.weights.push_back(std::exp(-0.5 * i));
+  }
+  return hit;
+}
+
+ModalOptions optionsFor(const benchmark::State& state) {
+  ModalOptions options {};
+  options.selection = static_cast<ModeSelection>(state.range(0));
+  options.modeCount = static_cast<int>(state.range(1));
+  return options;
+}
+
+// A cold solve per iteration: no basis in memory or on disk. The mesh and its assembly are shared
+// through keepMesh, so this times the eigensolve and retuning alone.
+void BM_initModalContext(benchmark::State& state) {
+  auto options = optionsFor(state);
+  // Builds the assembly
+  modalInstance(options);
+  uint64_t allocations = allocation_count();
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::filesystem::remove_all(cacheDir());
+    auto instance = std::make_unique<BonkInstance>();
+    instance->loadMesh(BONK_BENCH_MESH);
+    state.ResumeTiming();
+    if (instance->initModalContext(DENSITY, STIFFNESS, DT, 0.05, 0.01, options) != BonkInstance::BonkResult::Success) {
+      state.SkipWithError("initModalContext failed");
+      break;
+    }
+    state.PauseTiming();
+    instance.reset();
+    state.ResumeTiming();
+  }
+  set_counters(state, 0, allocations);
+}
+BENCHMARK(BM_initModalContext)
+  ->ArgNames({"selection", "modes"})
+  ->Args({static_cast<int>(ModeSelection::Largest), 50})
+  ->Args({static_cast<int>(ModeSelection::Lowest), 50})
+  ->Unit(benchmark::kMillisecond);
+
+// The same with the basis already in the disk cache, as a restarted server would find it
+void BM_initModalContextCached(benchmark::State& state) {
+  auto options = optionsFor(state);
+  // Solves and saves the basis, which is dropped from memory again along with the instance
+  modalInstance(options);
+  uint64_t allocations = allocation_count();
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto instance = std::make_unique<BonkInstance>();
+    instance->loadMesh(BONK_BENCH_MESH);
+    state.ResumeTiming();
+    if (instance->initModalContext(DENSITY, STIFFNESS, DT, 0.05, 0.01, options) != BonkInstance::BonkResult::Success) {
+      state.SkipWithError("initModalContext failed");
+      break;
+    }
+    state.PauseTiming();
+    instance.reset();
+    state.ResumeTiming();
+  }
+  set_counters(state, 0, allocations);
+}
+BENCHMARK(BM_initModalContextCached)
+  ->ArgNames({"selection", "modes"})
+  ->Args({static_cast<int>(ModeSelection::Largest), 50})
+  ->Args({static_cast<int>(ModeSelection::Lowest), 50})
+  ->Unit(benchmark::kMicrosecond);
+
+// One hit per iteration, mixed into what is already ringing
+void BM_bonk(benchmark::State& state) {
+  auto instance = modalInstance({});
+  auto hit = makeHit(*instance);
+  uint64_t allocations = allocation_count();
+  for (auto _ : state) {
+    instance->bonk(hit.indices, hit.weights, {0, 0, 1});
+  }
+  set_counters(state, 0, allocations);
+}
+BENCHMARK(BM_bonk);
+
+// One audio block per iteration, hit again whenever everything has died away
+void BM_runModal(benchmark::State& state) {
+  ModalOptions options {};
+  options.modeCount = static_cast<int>(state.range(0));
+  auto instance = modalInstance(options);
+  auto hit = makeHit(*instance);
+  instance->bonk(hit.indices, hit.weights, {0, 0, 1});
+  uint64_t allocations = allocation_count();
+  for (auto _ : state) {
+    if (instance->runModal(AUDIO_BLOCK) == BonkInstance::BonkResult::ModalCompleteExtinction) {
+      state.PauseTiming();
+      instance->bonk(hit.indices, hit.weights, {0, 0, 1});
+      state.ResumeTiming();
+    }
+  }
+  set_counters(state, AUDIO_BLOCK, allocations);
+}
+BENCHMARK(BM_runModal)->ArgName("modes")->Arg(50)->Arg(200);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  setenv("BONK_CACHE_DIR", cacheDir().c_str(), 1);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {return 1;}
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  std::filesystem::remove_all(cacheDir());
+  return 0;
+}
@@ -6,27 +6,150 @@ app.use(express.json());
 app.use(cors());
 const port = process.env.PORT || 3333;
 
-let bonkInstance
-try {
-  bonkInstance = new bonk.BonkInstance()
-} catch (error) {
-  console.error("Failed to create BonkInstance")
-  process.exit(1)
+// Mirrors BonkInstance::BonkResult in src/tet.hpp
+const BonkResult = {
+  Success: 0,
+  ModalCompleteExtinction: 6,
+  Cancelled: 7,
+  Busy: 8,
 }
 
+// A busy instance is a conflict the client can retry, anything else is a bad request
+const failureStatus = (response) => response == BonkResult.Busy ? 409 : 400
+
+// The addon hands out typed arrays over its own storage. Clients that accept application/octet-stream
+// get those bytes as-is (little-endian, element type in X-Bonk-Element-Type), everyone else gets JSON.
+const sendArray = (req, res, array) => {
+  if (req.accepts(['application/json', 'application/octet-stream']) == 'application/octet-stream') {
+    res.set('X-Bonk-Element-Type', array.constructor.name)
+    return res.type('application/octet-stream').send(Buffer.from(array.buffer, array.byteOffset, array.byteLength))
+  }
+  res.json({success:true, data:Array.from(array)})
+}
+
+// One BonkInstance per session, named by the X-Bonk-Session header or ?session= (clients sending
+// neither share "default"). Only /load opens a session, every other route needs one that exists.
+// Instances on the same mesh and parameters share that data inside the addon, so a session mostly
+// costs its own output buffer. Map order doubles as LRU order.
+const sessions = new Map()
+const memoryBudget = Number(process.env.BONK_MEMORY_BUDGET_MB ?? 1024) * 1024 * 1024
+const maxSessions = Number(process.env.BONK_MAX_SESSIONS ?? 64)
+const sessionIdleMs = Number(process.env.BONK_SESSION_IDLE_S ?? 600) * 1000
+
+const sessionId = (req) => req.get('X-Bonk-Session') ?? req.query.session ?? 'default'
+
+// Moves the session to the back of the LRU order
+const touch = (id, session) => {
+  sessions.delete(id)
+  session.lastUsed = Date.now()
+  sessions.set(id, session)
+}
+
+const closeSession = (id, session, reason) => {
+  session.instance.dispose()
+  sessions.delete(id)
+  console.log(`Closed session ${id}: ${reason}`)
+}
+
+// Bytes held by all sessions, shared model data counted once. Busy sessions can't report theirs.
+const memoryUsage = () => {
+  let own = 0
+  for (const {instance} of sessions.values()) {
+    own += instance.memoryUsage()?.own ?? 0
+  }
+  return {own, shared: bonk.sharedMemoryUsage()}
+}
+
+// Evicts least recently used sessions until under budget, sparing busy ones and the one just served
+const enforceBudget = (current) => {
+  for (const [id, session] of sessions) {
+    const {own, shared} = memoryUsage()
+    if (own + shared <= memoryBudget) {
+      return
+    }
+    if (id == current || session.instance.isBusy()) {
+      continue
+    }
+    closeSession(id, session, `evicted to stay within ${memoryBudget} bytes`)
+  }
+}
+
+// Makes room for one more session by evicting the least recently used idle one, if at the cap
+const reserveSession = () => {
+  if (sessions.size < maxSessions) {
+    return true
+  }
+  for (const [id, session] of sessions) {
+    if (!session.instance.isBusy()) {
+      closeSession(id, session, `evicted to stay within ${maxSessions} sessions`)
+      return true
+    }
+  }
+  return false
+}
+
+// Sets req.bonk to the request's session, creating it if create is set and 404ing otherwise
+const withSession = (create) => (req, res, next) => {
+  req.sessionId = sessionId(req)
+  let session = sessions.get(req.sessionId)
+  if (!session) {
+    if (!create) {
+      return res.status(404).json({error: "Unknown session", message: req.sessionId})
+    }
+    if (!reserveSession()) {
+      return res.status(503).json({error: "Too many sessions", message: "" + BonkResult.Busy})
+    }
+    session = {instance: new bonk.BonkInstance()}
+  }
+  touch(req.sessionId, session)
+  req.bonk = session.instance
+  res.on('finish', () => enforceBudget(req.sessionId))
+  next()
+}
+const openSession = withSession(true)
+const findSession = withSession(false)
+
+// Closes sessions nobody has used in a while, so clients that never DELETE /session don't pile up
+setInterval(() => {
+  const cutoff = Date.now() - sessionIdleMs
+  for (const [id, session] of sessions) {
+    if (session.lastUsed < cutoff && !session.instance.isBusy()) {
+      closeSession(id, session, `idle for over ${sessionIdleMs / 1000} s`)
+    }
+  }
+}, Math.min(sessionIdleMs, 60 * 1000)).unref()
+
 app.get('/status', (req, res) => {
-  res.json({status: 'ok', message: 'Running'})
+  res.json({status: 'ok', message: 'Running', sessions: sessions.size, maxSessions, memory: memoryUsage(), memoryBudget})
+})
+
+app.get('/session', findSession, (req, res) => {
+  res.json({success: true, id: req.sessionId, busy: req.bonk.isBusy(), memory: req.bonk.memoryUsage()})
+})
+
+app.delete('/session', findSession, (req, res) => {
+  if (!req.bonk.dispose()) {
+    return res.status(409).json({error: "Session is busy", message: "" + BonkResult.Busy})
+  }
+  sessions.delete(req.sessionId)
+  res.json({success: true})
+})
+
+// Stops whichever of /load, /readyThree, /modal or /run is in flight, which then fails with Cancelled
+app.post('/cancel', findSession, (req, res) => {
+  res.json({success: true, cancelled: req.bonk.cancel()})
 })
 
-app.post('/load', (req, res) => {
+// Meshing and solving for modes take seconds, so these run on the thread pool to keep serving meanwhile
+app.post('/load', openSession, async (req, res) => {
   try {
     const {name} = req.body
     if (!name || typeof name != 'string') {
       return res.status(400).json({error: "Invalid argument (load requires string)"})
     }
-    response = bonkInstance.loadMesh(name)
-    if (response != 0) {
-      return res.status(400).json({error: "Mesh loading failed", message: "" + response})
+    const response = await req.bonk.loadMeshAsync(name)
+    if (response != BonkResult.Success) {
+      return res.status(failureStatus(response)).json({error: "Mesh loading failed", message: "" + response})
     }
     res.json({success: true})
   } catch(error) {
@@ -35,11 +158,11 @@ app.post('/load', (req, res) => {
   }
 })
 
-app.post('/readyThree', (req, res) => {
+app.post('/readyThree', findSession, async (req, res) => {
   try {
-    response = bonkInstance.prepareThree()
-    if (response != 0) {
-      return res.status(400).json({error: "Three preparation failed", message: "" + response})
+    const response = await req.bonk.prepareThreeAsync()
+    if (response != BonkResult.Success) {
+      return res.status(failureStatus(response)).json({error: "Three preparation failed", message: "" + response})
     }
     res.json({success:true})
   } catch (error) {
@@ -48,51 +171,64 @@ app.post('/readyThree', (req, res) => {
   }
 })
 
-app.get('/indices', (req, res) => {
+app.get('/indices', findSession, (req, res) => {
   try {
-    const indices = bonkInstance.getIndices()
-    res.json({success:true, data:indices})
+    const indices = req.bonk.getIndices()
+    if (indices === null) {
+      return res.status(409).json({error: "Failed to fetch indices", message: "" + BonkResult.Busy})
+    }
+    sendArray(req, res, indices)
   } catch(error) {
     console.error(error)
     res.status(500).json({error: "Failed to fetch indices", message:error.message})
   }
 })
 
-app.get('/vertices', (req, res) => {
+app.get('/vertices', findSession, (req, res) => {
   try {
-    const vertices = bonkInstance.getVertices()
-    res.json({success:true, data:vertices})
+    const vertices = req.bonk.getVertices()
+    if (vertices === null) {
+      return res.status(409).json({error: "Failed to fetch vertices", message: "" + BonkResult.Busy})
+    }
+    sendArray(req, res, vertices)
   } catch(error) {
     console.error(error)
     res.status(500).json({error: "Failed to fetch vertices", message:error.message})
   }
 })
 
-app.post('/modal', (req, res) => {
+app.post('/modal', findSession, async (req, res) => {
   try {
-    const {density, k, dt, damping, freqDamping} = req.body
+    const {density, k, dt, damping, freqDamping, modes} = req.body
     if (typeof density != 'number' || typeof k != 'number' || typeof dt != 'number') {
       return res.status(400).json({error: "Invalid request (density, k, dt must be numbers)"})
     }
     let response
-    if (damping == undefined) {
-      response = bonkInstance.initModalContext(density, k, dt)
+    if (modes != undefined) {
+      // e.g. {selection: "lowest", modeCount: 30, maxFreq: 8000} or {selection: "window", minFreq: 200, maxFreq: 4000}
+      if (typeof modes != 'object') {
+        return res.status(400).json({error: "Invalid request (modes must be an object)"})
+      }
+      response = await req.bonk.initModalContextAsync(density, k, dt, damping ?? 0.0, freqDamping ?? 0.01, modes)
+    }
+    else if (damping == undefined) {
+      response = await req.bonk.initModalContextAsync(density, k, dt)
     }
     else if (freqDamping == undefined) {
       if (typeof damping != 'number') {
         return res.status(400).json({error: "Invalid request (damping must be a number)"})
       }
       else {
-        response = bonkInstance.initModalContext(density, k, dt, damping)
+        response = await req.bonk.initModalContextAsync(density, k, dt, damping)
       }
     } else {
       if (!(typeof damping == 'number' && typeof freqDamping == 'number')) {
         return res.status(400).json({error: "Invalid request (damping and freqDamping must be numbers)"})
       }
-      response = bonkInstance.initModalContext(density, k, dt, damping, freqDamping)
+      response = await req.bonk.initModalContextAsync(density, k, dt, damping, freqDamping)
     }
-    if (response != 0) {
-      return res.status(400).json({error: "Modal preparation failed", message: "" + response})
+    if (response != BonkResult.Success) {
+      return res.status(failureStatus(response)).json({error: "Modal preparation failed", message: "" + response})
     }
     res.json({success:true})
   } catch(error) {
@@ -101,15 +237,38 @@ app.post('/modal', (req, res) => {
   }
 })
 
-app.post('/bonk', (req, res) => {
+// Cheap re-parameterization of the context set up by /modal, without solving for modes again
+app.post('/retune', findSession, (req, res) => {
+  try {
+    const {density, k, damping, freqDamping, dt} = req.body
+    if ([density, k, damping, freqDamping, dt].some((v) => typeof v != 'number')) {
+      return res.status(400).json({error: "Invalid request (density, k, damping, freqDamping, dt must be numbers)"})
+    }
+    const response = req.bonk.retune(density, k, damping, freqDamping, dt)
+    if (response != BonkResult.Success) {
+      return res.status(failureStatus(response)).json({error: "Retuning failed", message: "" + response})
+    }
+    res.json({success:true})
+  } catch(error) {
+    console.error(error)
+    res.status(500).json({error: "Failed to retune modal system", message:error.message})
+  }
+})
+
+// Hits add to whatever is still ringing. An optional delay, in samples after the end of the last
+// /run, lets a burst of hits (rolls, rattles) be queued up and rendered by a single /run.
+app.post('/bonk', findSession, (req, res) => {
   try {
-    const {indices, weights, force} = req.body
+    const {indices, weights, force, delay} = req.body
     if (!Array.isArray(indices) || !Array.isArray(weights) || !Array.isArray(force)) {
       return res.status(400).json({error: "Invalid request (indices, weights, force must be arrays)"})
     }
-    const response = bonkInstance.bonk(indices, weights, force)
-    if (response != 0) {
-      return res.status(400).json({error: "Failed to bonk object", message: "" + response})
+    if (delay !== undefined && (!Number.isInteger(delay) || delay < 0)) {
+      return res.status(400).json({error: "Invalid request (delay must be a non-negative integer)"})
+    }
+    const response = req.bonk.bonk(indices, weights, force, delay)
+    if (response != BonkResult.Success) {
+      return res.status(failureStatus(response)).json({error: "Failed to bonk object", message: "" + response})
     }
     res.json({success:true})
   } 
@@ -119,30 +278,65 @@ app.post('/bonk', (req, res) => {
   }
 })
 
-app.post('/run', (req, res) => {
+// Stops everything ringing and every hit that has not started yet
+app.post('/silence', findSession, (req, res) => {
+  try {
+    const response = req.bonk.silence()
+    if (response != BonkResult.Success) {
+      return res.status(failureStatus(response)).json({error: "Failed to silence object", message: "" + response})
+    }
+    res.json({success:true})
+  }
+  catch(error) {
+    console.error(error)
+    res.status(500).json({error: "Failed to silence object", message:error.message})
+  }
+})
+
+app.post('/run', findSession, async (req, res) => {
   try {
     const {count} = req.body
-    if (typeof count != number || count < 0) {
-      return res.status(400).json({error:"Invalid request (count must be a positive number"})
+    if (typeof count != 'number' || count < 0) {
+      return res.status(400).json({error:"Invalid request (count must be a positive number)"})
     }
-    const response = bonkInstance.runModal(count)
-    if (response = 0) {
+    const response = await req.bonk.runModalAsync(count)
+    if (response == BonkResult.Success) {
       return res.json({success:true, extinction:false})
-    } else if (response == 6) {
+    } else if (response == BonkResult.ModalCompleteExtinction) {
       return res.json({success:true, extinction:true})
     } else {
-      return res.status(400).json({error: "Failed to run modal steps", message: "" + response})
+      return res.status(failureStatus(response)).json({error: "Failed to run modal steps", message: "" + response})
     }
   }
   catch (error) {
+    console.error(error)
     res.status(500).json({error: "Failed to run modal steps", message:error.message})
   }
 })
 
-app.get('/results', (req, res) => {
+// The session's current excitation as {freq, decay, amp, phase}, which the streaming server's
+// POST /api/sim/modal/:id plays back block by block instead of rendering it all up front with /run
+app.get('/modes', findSession, (req, res) => {
   try {
-    const results = bonkInstance.getModalResults()
-    res.json({success:true, data:results})
+    const state = req.bonk.getModalState()
+    if (state === null) {
+      return res.status(409).json({error: "Failed to fetch modes", message: "" + BonkResult.Busy})
+    }
+    const data = Object.fromEntries(Object.entries(state).map(([key, values]) => [key, Array.from(values)]))
+    res.json({success:true, data})
+  } catch(error) {
+    console.error(error)
+    res.status(500).json({error: "Failed to fetch modes", message:error.message})
+  }
+})
+
+app.get('/results', findSession, (req, res) => {
+  try {
+    const results = req.bonk.getModalResults()
+    if (results === null) {
+      return res.status(409).json({error: "Failed to fetch modal results", message: "" + BonkResult.Busy})
+    }
+    sendArray(req, res, results)
   } catch(error) {
     console.error(error)
     res.status(500).json({error: "Failed to fetch modal results", message:error.message})
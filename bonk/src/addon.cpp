@@ -1,20 +1,79 @@
 #include "napi.h"
 #include "tet.hpp"
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <span>
+#include <type_traits>
 #include <vector>
 
+using BonkResult = BonkInstance::BonkResult;
+
+// Runs one BonkInstance call on the libuv thread pool and settles a promise with its BonkResult.
+// The owning JS object is referenced until then, so it can't be collected under the worker.
+class BonkWorker: public Napi::AsyncWorker {
+public:
+  BonkWorker(Napi::Env env, Napi::Object owner, BonkInstance* instance, std::atomic<bool>& busy, std::function<BonkResult()> work)
+    : Napi::AsyncWorker(env), deferred_{Napi::Promise::Deferred::New(env)}, owner_{Napi::Persistent(owner)},
+      instance_{instance}, busy_{busy}, work_{std::move(work)} {}
+  Napi::Promise promise() {return deferred_.Promise();}
+  void Execute() override {
+    // CGAL and Eigen report some failures by throwing, which must not escape a pool thread
+    try {
+      result_ = work_();
+    } catch (const std::exception& e) {
+      SetError(e.what());
+    }
+  }
+  void OnOK() override {
+    release();
+    deferred_.Resolve(Napi::Number::New(Env(), static_cast<int>(result_)));
+  }
+  void OnError(const Napi::Error& e) override {
+    release();
+    deferred_.Reject(e.Value());
+  }
+private:
+  void release() {
+    // A cancel that arrived after the last checkpoint must not carry over to the next call
+    instance_->resetCancel();
+    busy_.store(false);
+  }
+  Napi::Promise::Deferred deferred_;
+  Napi::ObjectReference owner_;
+  BonkInstance* instance_;
+  std::atomic<bool>& busy_;
+  std::function<BonkResult()> work_;
+  BonkResult result_ {BonkResult::Success};
+};
+
 class BonkWrapper: public Napi::ObjectWrap<BonkWrapper> {
 public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports) {
     Napi::Function func = DefineClass(env, "BonkInstance", {
       InstanceMethod("loadMesh", &BonkWrapper::loadMesh),
+      InstanceMethod("loadMeshAsync", &BonkWrapper::loadMeshAsync),
       InstanceMethod("prepareThree", &BonkWrapper::prepareThree),
+      InstanceMethod("prepareThreeAsync", &BonkWrapper::prepareThreeAsync),
       InstanceMethod("isThreeReady", &BonkWrapper::isThreeReady),
       InstanceMethod("getIndices", &BonkWrapper::getIndices),
       InstanceMethod("getVertices", &BonkWrapper::getVertices),
       InstanceMethod("initModalContext", &BonkWrapper::initModalContext),
+      InstanceMethod("initModalContextAsync", &BonkWrapper::initModalContextAsync),
+      InstanceMethod("retune", &BonkWrapper::retune),
       InstanceMethod("bonk", &BonkWrapper::bonk),
+      InstanceMethod("silence", &BonkWrapper::silence),
       InstanceMethod("runModal", &BonkWrapper::runModal),
-      InstanceMethod("getModalResults", &BonkWrapper::getModalResults)
+      InstanceMethod("runModalAsync", &BonkWrapper::runModalAsync),
+      InstanceMethod("getModalResults", &BonkWrapper::getModalResults),
+      InstanceMethod("isBusy", &BonkWrapper::isBusy),
+      InstanceMethod("cancel", &BonkWrapper::cancel),
+      InstanceMethod("memoryUsage", &BonkWrapper::memoryUsage),
+      InstanceMethod("getModalState", &BonkWrapper::getModalState),
+      InstanceMethod("dispose", &BonkWrapper::dispose)
     });
     Napi::FunctionReference* constructor = new Napi::FunctionReference();
     *constructor = Napi::Persistent(func);
@@ -31,124 +90,316 @@ public:
   }
 private:
   BonkInstance* actualInstance_;
+  // Set while an *Async call owns the instance. Every other call is refused with BonkResult::Busy
+  // (or null, for the getters) until it settles, since the instance isn't safe to share.
+  std::atomic<bool> busy_ {false};
+  static Napi::Value result(Napi::Env env, BonkResult res) {
+    return Napi::Number::New(env, static_cast<int>(res));
+  }
+  Napi::Value queue(const Napi::CallbackInfo& info, std::function<BonkResult()> work) {
+    auto env = info.Env();
+    if (busy_.exchange(true)) {
+      auto deferred = Napi::Promise::Deferred::New(env);
+      deferred.Resolve(result(env, BonkResult::Busy));
+      return deferred.Promise();
+    }
+    actualInstance_->resetCancel();
+    auto worker = new BonkWorker(env, info.This().As<Napi::Object>(), actualInstance_, busy_, std::move(work));
+    auto promise = worker->promise();
+    worker->Queue();
+    return promise;
+  }
+  Napi::Value isBusy(const Napi::CallbackInfo& info) {
+    return Napi::Boolean::New(info.Env(), busy_.load());
+  }
+  // Resolves the pending *Async call with BonkResult::Cancelled once it reaches a checkpoint.
+  // Returns whether there was one to cancel.
+  Napi::Value cancel(const Napi::CallbackInfo& info) {
+    bool busy = busy_.load();
+    if (busy) {
+      actualInstance_->cancel();
+    }
+    return Napi::Boolean::New(info.Env(), busy);
+  }
+  // {own, shared} in bytes, shared being the model parts this instance references, see ModelStore
+  Napi::Value memoryUsage(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if (busy_) {return env.Null();}
+    auto usage = actualInstance_->memoryUsage();
+    auto obj = Napi::Object::New(env);
+    obj.Set("own", Napi::Number::New(env, static_cast<double>(usage.own)));
+    obj.Set("shared", Napi::Number::New(env, static_cast<double>(usage.shared)));
+    return obj;
+  }
+  // {freq, decay, amp, phase} as Float64Arrays, see BonkInstance::ModalState
+  Napi::Value getModalState(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if (busy_) {return env.Null();}
+    auto state = actualInstance_->modalState();
+    auto obj = Napi::Object::New(env);
+    obj.Set("freq", view(env, std::make_shared<const std::vector<double>>(std::move(state.freq))));
+    obj.Set("decay", view(env, std::make_shared<const std::vector<double>>(std::move(state.decay))));
+    obj.Set("amp", view(env, std::make_shared<const std::vector<double>>(std::move(state.amp))));
+    obj.Set("phase", view(env, std::make_shared<const std::vector<double>>(std::move(state.phase))));
+    return obj;
+  }
+  // Lets go of everything now instead of whenever this object is collected, leaving a fresh
+  // instance behind. Refused, returning false, while an *Async call is running.
+  Napi::Value dispose(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if (busy_) {return Napi::Boolean::New(env, false);}
+    delete actualInstance_;
+    actualInstance_ = new BonkInstance();
+    return Napi::Boolean::New(env, true);
+  }
   Napi::Value loadMesh(const Napi::CallbackInfo& info) {
     auto env = info.Env();
     if (info.Length() < 1 || !info[0].IsString()) {
-      Napi::TypeError::New(env, "loadMesh requires a string argument");
+      Napi::TypeError::New(env, "loadMesh requires a string argument").ThrowAsJavaScriptException();
       return env.Null();
     }
+    if (busy_) {return result(env, BonkResult::Busy);}
     std::string str = info[0].As<Napi::String>().Utf8Value();
     auto res = actualInstance_->loadMesh(str);
-    return Napi::Number::New(env, static_cast<int>(res));
+    return result(env, res);
+  }
+  Napi::Value loadMeshAsync(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if (info.Length() < 1 || !info[0].IsString()) {
+      Napi::TypeError::New(env, "loadMeshAsync requires a string argument").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    std::string str = info[0].As<Napi::String>().Utf8Value();
+    return queue(info, [instance = actualInstance_, str] {return instance->loadMesh(str);});
   }
   Napi::Value prepareThree(const Napi::CallbackInfo& info) {
     auto env = info.Env();
+    if (busy_) {return result(env, BonkResult::Busy);}
     auto res = actualInstance_->prepareThree();
-    return Napi::Number::New(env, static_cast<int>(res));
+    return result(env, res);
+  }
+  Napi::Value prepareThreeAsync(const Napi::CallbackInfo& info) {
+    return queue(info, [instance = actualInstance_] {return instance->prepareThree();});
   }
   Napi::Value isThreeReady(const Napi::CallbackInfo& info) {
     auto env = info.Env();
+    if (busy_) {return Napi::Boolean::New(env, false);}
     auto res = actualInstance_->threeReady();
     return Napi::Boolean::New(env, res);
   }
+  // A typed array over storage, which stays alive until the array is collected. Nothing is copied,
+  // so writes from JS land in storage too and should be avoided.
+  template <typename T>
+  static Napi::Value view(Napi::Env env, std::shared_ptr<const std::vector<T>> storage) {
+    if (storage->empty()) {
+      return Napi::TypedArrayOf<T>::New(env, 0, Napi::ArrayBuffer::New(env, 0), 0);
+    }
+    auto* holder = new std::shared_ptr<const std::vector<T>>(std::move(storage));
+    auto buffer = Napi::ArrayBuffer::New(env, const_cast<T*>((*holder)->data()), (*holder)->size() * sizeof(T),
+      [](Napi::Env, void*, std::shared_ptr<const std::vector<T>>* hint) {delete hint;}, holder);
+    return Napi::TypedArrayOf<T>::New(env, (*holder)->size(), buffer, 0);
+  }
   Napi::Value getIndices(const Napi::CallbackInfo& info) {
     auto env = info.Env();
-    auto res = actualInstance_->getIndices();
-    Napi::Array arr = Napi::Array::New(env, res.size());
-    for (size_t i = 0; i < res.size(); i++) {
-      arr.Set(i,Napi::Number::New(env, res[i]));
-    }
-    return arr;
+    if (busy_) {return env.Null();}
+    return view(env, actualInstance_->getIndices());
   }
   Napi::Value getVertices(const Napi::CallbackInfo& info) {
     auto env = info.Env();
-    auto res = actualInstance_->getVertices();
-    Napi::Array arr = Napi::Array::New(env, res.size());
-    for (size_t i = 0; i < res.size(); i++) {
-      arr.Set(i,Napi::Number::New(env, res[i]));
+    if (busy_) {return env.Null();}
+    return view(env, actualInstance_->getVertices());
+  }
+  static bool parseModalOptions(Napi::Value value, ModalOptions& options) {
+    if (!value.IsObject()) {return false;}
+    auto obj = value.As<Napi::Object>();
+    if (obj.Has("selection")) {
+      auto v = obj.Get("selection");
+      if (!v.IsString()) {return false;}
+      auto selection = v.As<Napi::String>().Utf8Value();
+      if (selection == "largest") {options.selection = ModeSelection::Largest;}
+      else if (selection == "lowest") {options.selection = ModeSelection::Lowest;}
+      else if (selection == "window") {options.selection = ModeSelection::Window;}
+      else {return false;}
+    }
+    for (auto [name, field] : {std::pair{"minFreq", &options.minFreq}, std::pair{"maxFreq", &options.maxFreq}}) {
+      if (obj.Has(name)) {
+        auto v = obj.Get(name);
+        if (!v.IsNumber()) {return false;}
+        *field = v.As<Napi::Number>().DoubleValue();
+      }
+    }
+    for (auto [name, field] : {std::pair{"modeCount", &options.modeCount}, std::pair{"maxModes", &options.maxModes}}) {
+      if (obj.Has(name)) {
+        auto v = obj.Get(name);
+        if (!v.IsNumber()) {return false;}
+        *field = v.As<Napi::Number>().Int32Value();
+      }
     }
-    return arr;
+    return true;
   }
-  Napi::Value initModalContext(const Napi::CallbackInfo& info) {
-    auto env = info.Env();
+  struct ModalArgs {
+    double density, k, dt;
+    double damping {0.0};
+    double freqDamping {0.01};
+    ModalOptions options {};
+  };
+  // Shared by initModalContext and initModalContextAsync, sets error and returns false on bad arguments
+  static bool parseModalArgs(const Napi::CallbackInfo& info, ModalArgs& args, const char*& error) {
     if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsNumber() || !info[2].IsNumber() || (info.Length() >= 4 && !info[3].IsNumber()) || (info.Length() >= 5 && !info[4].IsNumber())) {
-      Napi::TypeError::New(env, "initModalContext requires 3-5 numeric arguments");
-      return env.Null();
+      error = "initModalContext requires 3-5 numeric arguments and an optional options object";
+      return false;
     }
-    double density = info[0].As<Napi::Number>().DoubleValue();
-    double k = info[1].As<Napi::Number>().DoubleValue();
-    double dt = info[2].As<Napi::Number>().DoubleValue();
-    double damping = 0.0; double freqDamping = 0.01;
+    args.density = info[0].As<Napi::Number>().DoubleValue();
+    args.k = info[1].As<Napi::Number>().DoubleValue();
+    args.dt = info[2].As<Napi::Number>().DoubleValue();
     if (info.Length() >= 4) {
-      damping = info[3].As<Napi::Number>().DoubleValue();
+      args.damping = info[3].As<Napi::Number>().DoubleValue();
     }
     if (info.Length() >= 5) {
-      freqDamping = info[4].As<Napi::Number>().DoubleValue();
+      args.freqDamping = info[4].As<Napi::Number>().DoubleValue();
     }
-    auto res = actualInstance_->initModalContext(density, k, dt, damping, freqDamping);
-    return Napi::Number::New(env, static_cast<int>(res));
+    if (info.Length() >= 6 && !parseModalOptions(info[5], args.options)) {
+      error = "initModalContext options must be {selection: 'largest' | 'lowest' | 'window', modeCount, minFreq, maxFreq, maxModes}";
+      return false;
+    }
+    return true;
   }
-  Napi::Value bonk(const Napi::CallbackInfo& info) {
+  Napi::Value initModalContext(const Napi::CallbackInfo& info) {
     auto env = info.Env();
-    if (info.Length() < 3 || !info[0].IsArray() || !info[1].IsArray() || !info[2].IsArray() || info[2].As<Napi::Array>().Length() != 3) {
-      Napi::TypeError::New(env, "bonk requires 3 numeric array arguments");
+    ModalArgs args {};
+    const char* error = nullptr;
+    if (!parseModalArgs(info, args, error)) {
+      Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
       return env.Null();
     }
-    Napi::Array indices = info[0].As<Napi::Array>();
-    Napi::Array weights = info[0].As<Napi::Array>();
-    Napi::Array force = info[0].As<Napi::Array>();
-    std::vector<int> inds {};
-    std::vector<double> ws {};
-    std::array<double, 3> forceDir {};
-    for (size_t i = 0; i < indices.Length(); i++){
-      auto v {indices.Get(i)};
-      if (!v.IsNumber()) {
-        Napi::TypeError::New(env, "invalid element type in index array");
-        return env.Null();
+    if (busy_) {return result(env, BonkResult::Busy);}
+    auto res = actualInstance_->initModalContext(args.density, args.k, args.dt, args.damping, args.freqDamping, args.options);
+    return result(env, res);
+  }
+  Napi::Value initModalContextAsync(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    ModalArgs args {};
+    const char* error = nullptr;
+    if (!parseModalArgs(info, args, error)) {
+      Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    return queue(info, [instance = actualInstance_, args] {
+      return instance->initModalContext(args.density, args.k, args.dt, args.damping, args.freqDamping, args.options);
+    });
+  }
+  Napi::Value retune(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if (info.Length() < 5 || !info[0].IsNumber() || !info[1].IsNumber() || !info[2].IsNumber() || !info[3].IsNumber() || !info[4].IsNumber()) {
+      Napi::TypeError::New(env, "retune requires 5 numeric arguments").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    double density = info[0].As<Napi::Number>().DoubleValue();
+    double k = info[1].As<Napi::Number>().DoubleValue();
+    double damping = info[2].As<Napi::Number>().DoubleValue();
+    double freqDamping = info[3].As<Napi::Number>().DoubleValue();
+    double dt = info[4].As<Napi::Number>().DoubleValue();
+    if (busy_) {return result(env, BonkResult::Busy);}
+    auto res = actualInstance_->retune(density, k, damping, freqDamping, dt);
+    return result(env, res);
+  }
+  // Borrows a typed array of exactly T (given as type), otherwise converts a typed or plain array
+  // into scratch. For an integer T every element must be a whole number T can hold.
+  template <typename T>
+  static bool readNumbers(Napi::Value value, napi_typedarray_type type, std::vector<T>& scratch, std::span<const T>& out) {
+    if (value.IsTypedArray()) {
+      if (value.As<Napi::TypedArray>().TypedArrayType() == type) {
+        auto exact = value.As<Napi::TypedArrayOf<T>>();
+        out = {exact.Data(), exact.ElementLength()};
+        return true;
       }
-      inds.push_back(v.As<Napi::Number>().Int32Value());
+    } else if (!value.IsArray()) {
+      return false;
     }
-    for (size_t i = 0; i < weights.Length(); i++){
-      auto v {indices.Get(i)};
-      if (!v.IsNumber()) {
-        Napi::TypeError::New(env, "invalid element type in index array");
-        return env.Null();
+    auto obj = value.As<Napi::Object>();
+    size_t length = value.IsArray() ? value.As<Napi::Array>().Length() : value.As<Napi::TypedArray>().ElementLength();
+    scratch.resize(length);
+    for (size_t i = 0; i < length; i++) {
+      auto v = obj.Get(static_cast<uint32_t>(i));
+      if (!v.IsNumber()) {return false;}
+      double d = v.As<Napi::Number>().DoubleValue();
+      if constexpr (std::is_integral_v<T>) {
+        // Converting anything else to T is undefined
+        if (!(d >= std::numeric_limits<T>::min() && d <= std::numeric_limits<T>::max() && d == std::floor(d))) {
+          return false;
+        }
       }
-      ws.push_back(v.As<Napi::Number>().DoubleValue());
+      scratch[i] = static_cast<T>(d);
     }
-    for (int i = 0; i < 3; i++){
-      auto v {indices.Get(i)};
-      if (!v.IsNumber()) {
-        Napi::TypeError::New(env, "invalid element type in index array");
+    out = scratch;
+    return true;
+  }
+  // Takes indices as a Uint32Array and weights and force as Float64Arrays without copying, or as any
+  // other arrays of numbers
+  Napi::Value bonk(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    std::vector<uint32_t> indexScratch {};
+    std::vector<double> weightScratch {}, forceScratch {};
+    std::span<const uint32_t> inds {};
+    std::span<const double> ws {}, force {};
+    if (info.Length() < 3 || !readNumbers(info[0], napi_uint32_array, indexScratch, inds) || !readNumbers(info[1], napi_float64_array, weightScratch, ws) || !readNumbers(info[2], napi_float64_array, forceScratch, force) || force.size() != 3) {
+      Napi::TypeError::New(env, "bonk requires index, weight and 3-element force arrays of numbers").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    int delay = 0;
+    if (info.Length() > 3 && !info[3].IsUndefined()) {
+      if (!info[3].IsNumber()) {
+        Napi::TypeError::New(env, "bonk delay must be a number of samples").ThrowAsJavaScriptException();
         return env.Null();
       }
-      forceDir[i] = v.As<Napi::Number>().DoubleValue();
+      delay = info[3].As<Napi::Number>().Int32Value();
     }
-    auto res = actualInstance_->bonk(inds, ws, forceDir);
-    return Napi::Number::New(env, static_cast<int>(res));
+    if (busy_) {return result(env, BonkResult::Busy);}
+    std::array<double, 3> forceDir {force[0], force[1], force[2]};
+    auto res = actualInstance_->bonk(inds, ws, forceDir, delay);
+    return result(env, res);
+  }
+  Napi::Value silence(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if (busy_) {return result(env, BonkResult::Busy);}
+    actualInstance_->silence();
+    return result(env, BonkResult::Success);
   }
   Napi::Value runModal(const Napi::CallbackInfo& info) {
     auto env = info.Env();
     if (info.Length() == 0 || !info[0].IsNumber()) {
-      Napi::TypeError::New(env, "runModal requires a numeric argument");
+      Napi::TypeError::New(env, "runModal requires a numeric argument").ThrowAsJavaScriptException();
       return env.Null();
     }
     auto count = info[0].As<Napi::Number>().Int32Value();
+    if (busy_) {return result(env, BonkResult::Busy);}
     auto res = actualInstance_->runModal(count);
-    return Napi::Number::New(env, static_cast<int>(res));
+    return result(env, res);
   }
-  Napi::Value getModalResults(const Napi::CallbackInfo& info) {
+  // Results are read back with getModalResults once the promise resolves
+  Napi::Value runModalAsync(const Napi::CallbackInfo& info) {
     auto env = info.Env();
-    auto res = actualInstance_->getResults();
-    Napi::Array arr = Napi::Array::New(env, res.size());
-    for (size_t i = 0; i < res.size(); i++) {
-      arr.Set(i, Napi::Number::New(env, res[i]));
+    if (info.Length() == 0 || !info[0].IsNumber()) {
+      Napi::TypeError::New(env, "runModalAsync requires a numeric argument").ThrowAsJavaScriptException();
+      return env.Null();
     }
-    return arr;
+    auto count = info[0].As<Napi::Number>().Int32Value();
+    return queue(info, [instance = actualInstance_, count] {return instance->runModal(count);});
+  }
+  Napi::Value getModalResults(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+    if (busy_) {return env.Null();}
+    return view(env, actualInstance_->getResults());
   }
 };
 
+// Bytes of every live shared model part, each counted once however many instances use it
+Napi::Value SharedMemoryUsage(const Napi::CallbackInfo& info) {
+  return Napi::Number::New(info.Env(), static_cast<double>(ModelStore::shared().bytes()));
+}
+
 Napi::Object InitAll(Napi::Env env, Napi::Object exports) {
+  exports.Set("sharedMemoryUsage", Napi::Function::New(env, SharedMemoryUsage));
   return BonkWrapper::Init(env, exports);
 }
 
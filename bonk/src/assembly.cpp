@@ -0,0 +1,172 @@
+#include "assembly.hpp"
+#include <algorithm>
+#include <cmath>
+#include <eigen3/Eigen/Geometry>
+#include <thread>
+
+// Below this many tets a single thread is faster than starting more
+static constexpr size_t MIN_TETS_PER_THREAD {4096};
+
+// Runs f(begin, end, thread) over contiguous chunks of [0, n), one per thread
+template <typename F>
+static void parallelFor(size_t n, size_t threadCount, F f) {
+  if (threadCount <= 1) {
+    f(size_t {0}, n, size_t {0});
+    return;
+  }
+  std::vector<std::thread> threads {};
+  size_t chunk = (n + threadCount - 1) / threadCount;
+  for (size_t t = 0; t < threadCount; t++) {
+    size_t begin = std::min(n, t * chunk);
+    size_t end = std::min(n, begin + chunk);
+    threads.emplace_back([=, &f]() {f(begin, end, t);});
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void Assembly::build(const std::vector<double>& positions, const std::vector<int>& tets) {
+  size_t vertCount = positions.size() / 3;
+  size_t tetCount = tets.size() / 4;
+  size_t threadCount = std::clamp<size_t>(tetCount / MIN_TETS_PER_THREAD, 1, std::max(1u, std::thread::hardware_concurrency()));
+
+  // Pattern: every vertex of a tet neighbours the other three, counted with duplicates first
+  std::vector<int> degree(vertCount + 1, 1);
+  for (int u : tets) {
+    degree[u] += 3;
+  }
+  std::vector<int> start(vertCount + 1, 0);
+  for (size_t u = 0; u < vertCount; u++) {
+    start[u + 1] = start[u] + degree[u];
+  }
+  std::vector<int> neighbours(start[vertCount]);
+  std::vector<int> fill(start.begin(), start.end() - 1);
+  for (size_t u = 0; u < vertCount; u++) {
+    neighbours[fill[u]++] = static_cast<int>(u);
+  }
+  for (size_t t = 0; t < tetCount; t++) {
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 4; j++) {
+        if (i != j) {
+          neighbours[fill[tets[4*t+i]]++] = tets[4*t+j];
+        }
+      }
+    }
+  }
+
+  // Sort and deduplicate each row, compacting in place
+  rowStart.assign(vertCount + 1, 0);
+  cols.clear();
+  cols.reserve(neighbours.size());
+  for (size_t u = 0; u < vertCount; u++) {
+    auto first = neighbours.begin() + start[u];
+    auto last = neighbours.begin() + start[u + 1];
+    std::sort(first, last);
+    last = std::unique(first, last);
+    cols.insert(cols.end(), first, last);
+    rowStart[u + 1] = static_cast<int>(cols.size());
+  }
+
+  // Where each pair of a tet's vertices lands, so filling values is a plain scatter
+  tetSlots.resize(16 * tetCount);
+  parallelFor(tetCount, threadCount, [&](size_t begin, size_t end, size_t) {
+    for (size_t t = begin; t < end; t++) {
+      for (int i = 0; i < 4; i++) {
+        int u = tets[4*t+i];
+        for (int j = 0; j < 4; j++) {
+          auto row = cols.begin() + rowStart[u];
+          auto rowEnd = cols.begin() + rowStart[u + 1];
+          tetSlots[16*t + 4*i + j] = static_cast<int>(std::lower_bound(row, rowEnd, tets[4*t+j]) - cols.begin());
+        }
+      }
+    }
+  });
+
+  // Each thread accumulates its own cells, then the partial sums are reduced
+  std::vector<std::vector<double>> partialLaplacian(threadCount);
+  std::vector<std::vector<double>> partialVolume(threadCount);
+  auto position = [&](int u) {
+    return Eigen::Vector3d(positions[3*u], positions[3*u+1], positions[3*u+2]);
+  };
+  parallelFor(tetCount, threadCount, [&](size_t begin, size_t end, size_t thread) {
+    auto& values = partialLaplacian[thread];
+    auto& volume = partialVolume[thread];
+    values.assign(cols.size(), 0.0);
+    volume.assign(vertCount, 0.0);
+    for (size_t t = begin; t < end; t++) {
+      const int* cell = &tets[4*t];
+      const int* slots = &tetSlots[16*t];
+      auto p0 = position(cell[0]);
+      double vol = std::abs((position(cell[1]) - p0).dot((position(cell[2]) - p0).cross(position(cell[3]) - p0))) / 6.0;
+      for (int i = 0; i < 4; i++) {
+        volume[cell[i]] += vol / 4;
+        for (int j = i + 1; j < 4; j++) {
+          values[slots[4*i+i]] += 1.0;
+          values[slots[4*j+j]] += 1.0;
+          values[slots[4*i+j]] -= 1.0;
+          values[slots[4*j+i]] -= 1.0;
+        }
+      }
+    }
+  });
+  laplacian.assign(cols.size(), 0.0);
+  vertexVolume.assign(vertCount, 0.0);
+  parallelFor(cols.size(), threadCount, [&](size_t begin, size_t end, size_t) {
+    for (auto& values : partialLaplacian) {
+      for (size_t i = begin; i < end; i++) {laplacian[i] += values[i];}
+    }
+  });
+  for (auto& volume : partialVolume) {
+    for (size_t u = 0; u < vertCount; u++) {vertexVolume[u] += volume[u];}
+  }
+}
+
+Assembly::SpMat Assembly::stiffness(double k) const {
+  // Column 3u+c holds rows 3v+c for every neighbour v of u, so the pattern is the vertex pattern
+  // repeated per component. Symmetric, so it doesn't matter that Eigen stores columns.
+  auto vertCount = static_cast<int>(rowStart.size()) - 1;
+  SpMat K(3*vertCount, 3*vertCount);
+  K.resizeNonZeros(3 * static_cast<Eigen::Index>(cols.size()));
+  auto outer = K.outerIndexPtr();
+  auto inner = K.innerIndexPtr();
+  auto values = K.valuePtr();
+  Eigen::Index pos {0};
+  for (int u = 0; u < vertCount; u++) {
+    for (int c = 0; c < 3; c++) {
+      outer[3*u+c] = static_cast<int>(pos);
+      for (int i = rowStart[u]; i < rowStart[u + 1]; i++) {
+        inner[pos] = 3*cols[i] + c;
+        values[pos] = k * laplacian[i];
+        pos++;
+      }
+    }
+  }
+  outer[3*vertCount] = static_cast<int>(pos);
+  return K;
+}
+
+Assembly::V Assembly::massDiagonal(double density) const {
+  V mass(3 * vertexVolume.size());
+  for (size_t u = 0; u < vertexVolume.size(); u++) {
+    mass.segment<3>(3*u).setConstant(density * vertexVolume[u]);
+  }
+  return mass;
+}
+
+Assembly::SpMat Assembly::diagonal(const V& d) {
+  SpMat D(d.size(), d.size());
+  D.resizeNonZeros(d.size());
+  for (Eigen::Index i = 0; i < d.size(); i++) {
+    D.outerIndexPtr()[i] = static_cast<int>(i);
+    D.innerIndexPtr()[i] = static_cast<int>(i);
+    D.valuePtr()[i] = d[i];
+  }
+  D.outerIndexPtr()[d.size()] = static_cast<int>(d.size());
+  return D;
+}
+
+size_t Assembly::bytes() const {
+  return (rowStart.capacity() + cols.capacity() + tetSlots.capacity()) * sizeof(int)
+    + (laplacian.capacity() + vertexVolume.capacity()) * sizeof(double);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Sparse>
+#include <vector>
+
+// Sparsity pattern and the parameter-free parts of the stiffness and mass matrices of a tet mesh.
+// Built once per mesh, after which assembling for any density and k is a scale and a copy.
+class Assembly {
+using SpMat = Eigen::SparseMatrix<double>;
+using V = Eigen::VectorXd;
+public:
+  void build(const std::vector<double>& positions, const std::vector<int>& tets);
+  bool empty() const {return rowStart.empty();}
+  // k * (L kron I3), where L is the Laplacian of the tet edge graph with each edge weighted by the
+  // number of tets sharing it. The same as a spring of stiffness k along every edge of every tet.
+  SpMat stiffness(double k) const;
+  // Lumped mass per degree of freedom, a quarter of each tet's mass going to each of its vertices
+  V massDiagonal(double density) const;
+  static SpMat diagonal(const V& d);
+  size_t bytes() const;
+private:
+  // CSR over vertices, columns sorted and including the diagonal
+  std::vector<int> rowStart {};
+  std::vector<int> cols {};
+  std::vector<double> laplacian {};
+  std::vector<double> vertexVolume {};
+  // Position in cols of (a, b) for every pair of vertices a, b of each tet, 16 per tet
+  std::vector<int> tetSlots {};
+};
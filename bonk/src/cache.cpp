@@ -0,0 +1,203 @@
+#include "cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump whenever meshing, assembly or the file layout changes so stale entries are ignored
+static constexpr uint32_t CACHE_VERSION {2};
+static constexpr char MAGIC[4] {'B', 'N', 'K', 'C'};
+static constexpr int MAX_SECTIONS {4};
+
+// Every file is this header followed by the sections back to back
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t sectionBytes[MAX_SECTIONS];
+};
+
+static constexpr uint64_t FNV_OFFSET {14695981039346656037ull};
+static constexpr uint64_t FNV_PRIME {1099511628211ull};
+
+static uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FNV_OFFSET) {
+  auto bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+struct Section {
+  const void* data;
+  size_t bytes;
+};
+
+// Written under a temporary name and renamed, so readers never see a partial file
+static void writeSections(const std::filesystem::path& path, uint64_t key, std::initializer_list<Section> sections) {
+  CacheHeader header {};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = CACHE_VERSION;
+  header.key = key;
+  int i {0};
+  for (auto& section : sections) {
+    header.sectionBytes[i++] = section.bytes;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  // Unique per writer, since two threads of this process can miss on the same key at once
+  static std::atomic<uint64_t> writes {0};
+  auto tmp = path;
+  tmp += "." + std::to_string(getpid()) + "." + std::to_string(writes++) + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (auto& section : sections) {
+      out.write(static_cast<const char*>(section.data), section.bytes);
+    }
+    if (!out) {
+      std::filesystem::remove(tmp, ec);
+      return;
+    }
+  }
+  std::filesystem::rename(tmp, path, ec);
+}
+
+// Read-only mapping of a whole cache file, valid only if its header matches key
+class MappedFile {
+public:
+  MappedFile(const std::filesystem::path& path, uint64_t key) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {return;}
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(CacheHeader)) {
+      size = static_cast<size_t>(st.st_size);
+      void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      data = p == MAP_FAILED ? nullptr : static_cast<const char*>(p);
+    }
+    close(fd);
+    if (!data) {return;}
+    std::memcpy(&header, data, sizeof(header));
+    uint64_t total {sizeof(CacheHeader)};
+    for (auto bytes : header.sectionBytes) {total += bytes;}
+    valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == CACHE_VERSION && header.key == key && total == size;
+  }
+  ~MappedFile() {
+    if (data) {munmap(const_cast<char*>(data), size);}
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  bool ok() const {return valid;}
+  size_t sectionBytes(int i) const {return header.sectionBytes[i];}
+  // Copies section i into dst, which must hold sectionBytes(i)
+  void copySection(int i, void* dst) const {
+    size_t offset {sizeof(CacheHeader)};
+    for (int j = 0; j < i; j++) {offset += header.sectionBytes[j];}
+    std::memcpy(dst, data + offset, header.sectionBytes[i]);
+  }
+private:
+  const char* data {nullptr};
+  size_t size {0};
+  CacheHeader header {};
+  bool valid {false};
+};
+
+template <typename T>
+static bool copyToVector(const MappedFile& file, int section, std::vector<T>& out) {
+  if (file.sectionBytes(section) % sizeof(T) != 0) {return false;}
+  out.resize(file.sectionBytes(section) / sizeof(T));
+  file.copySection(section, out.data());
+  return true;
+}
+
+// Whether every index is in [0, count)
+static bool inRange(const std::vector<int>& indices, size_t count) {
+  return std::all_of(indices.begin(), indices.end(), [count](int i) {return i >= 0 && static_cast<size_t>(i) < count;});
+}
+
+DiskCache::DiskCache() {
+  if (const char* env = std::getenv("BONK_CACHE_DIR")) {
+    dir = env;
+  } else {
+    std::error_code ec;
+    dir = std::filesystem::temp_directory_path(ec) / "bonk-cache";
+  }
+}
+
+std::optional<uint64_t> DiskCache::hashFile(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in) {return std::nullopt;}
+  uint64_t hash {FNV_OFFSET};
+  std::vector<char> buffer(1 << 16);
+  while (in) {
+    in.read(buffer.data(), buffer.size());
+    hash = fnv1a(buffer.data(), static_cast<size_t>(in.gcount()), hash);
+  }
+  return hash;
+}
+
+uint64_t DiskCache::modalKey(uint64_t meshHash, const ModalOptions& options) {
+  uint64_t hash = fnv1a(&meshHash, sizeof(meshHash));
+  // Field by field, the struct has padding
+  hash = fnv1a(&options.selection, sizeof(options.selection), hash);
+  hash = fnv1a(&options.modeCount, sizeof(options.modeCount), hash);
+  hash = fnv1a(&options.minFreq, sizeof(options.minFreq), hash);
+  hash = fnv1a(&options.maxFreq, sizeof(options.maxFreq), hash);
+  return fnv1a(&options.maxModes, sizeof(options.maxModes), hash);
+}
+
+std::filesystem::path DiskCache::pathFor(uint64_t key, const char* extension) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.%s", static_cast<unsigned long long>(key), extension);
+  return dir / name;
+}
+
+bool DiskCache::loadMesh(uint64_t key, MeshData& mesh) const {
+  MappedFile file(pathFor(key, "mesh"), key);
+  if (!file.ok()) {return false;}
+  if (!copyToVector(file, 0, mesh.positions) || !copyToVector(file, 1, mesh.tets) ||
+      !copyToVector(file, 2, mesh.threeToLocal) || !copyToVector(file, 3, mesh.threeIndices)) {
+    return false;
+  }
+  // A header that checks out doesn't make the indices safe to follow, treat a bad file as a miss
+  auto vertexCount = mesh.positions.size() / 3;
+  return mesh.positions.size() % 3 == 0 && mesh.tets.size() % 4 == 0 && mesh.threeIndices.size() % 3 == 0 &&
+    inRange(mesh.tets, vertexCount) && inRange(mesh.threeToLocal, vertexCount) &&
+    inRange(mesh.threeIndices, mesh.threeToLocal.size());
+}
+
+void DiskCache::saveMesh(uint64_t key, const MeshData& mesh) const {
+  writeSections(pathFor(key, "mesh"), key, {
+    {mesh.positions.data(), mesh.positions.size() * sizeof(double)},
+    {mesh.tets.data(), mesh.tets.size() * sizeof(int)},
+    {mesh.threeToLocal.data(), mesh.threeToLocal.size() * sizeof(int)},
+    {mesh.threeIndices.data(), mesh.threeIndices.size() * sizeof(int)},
+  });
+}
+
+bool DiskCache::loadModal(uint64_t key, Eigen::Index rows, Eigen::VectorXd& freq, Eigen::MatrixXd& modes) const {
+  MappedFile file(pathFor(key, "modal"), key);
+  if (!file.ok() || rows <= 0 || file.sectionBytes(0) % sizeof(double) != 0) {return false;}
+  auto count = static_cast<Eigen::Index>(file.sectionBytes(0) / sizeof(double));
+  // Modes are indexed by vertex without further checks, so a basis for any other mesh is a miss
+  if (count == 0 || file.sectionBytes(1) != static_cast<size_t>(rows * count) * sizeof(double)) {return false;}
+  freq.resize(count);
+  file.copySection(0, freq.data());
+  // Column-major, so each mode is contiguous
+  modes.resize(rows, count);
+  file.copySection(1, modes.data());
+  return true;
+}
+
+void DiskCache::saveModal(uint64_t key, const Eigen::VectorXd& freq, const Eigen::MatrixXd& modes) const {
+  writeSections(pathFor(key, "modal"), key, {
+    {freq.data(), freq.size() * sizeof(double)},
+    {modes.data(), modes.size() * sizeof(double)},
+  });
+}
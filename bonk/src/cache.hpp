@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <eigen3/Eigen/Core>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+#include "modal.hpp"
+
+// Everything BonkInstance needs from a meshed model, in plain arrays so it can be used without CGAL
+struct MeshData {
+  // xyz of each local vertex
+  std::vector<double> positions {};
+  // Four local vertex indices per tetrahedron
+  std::vector<int> tets {};
+  // Local vertex of each three.js vertex
+  std::vector<int> threeToLocal {};
+  // Three three.js vertex indices per outward facing surface triangle
+  std::vector<int> threeIndices {};
+};
+
+// Content-addressed store of meshes and modal bases, one memory-mapped binary file per entry. The
+// directory is BONK_CACHE_DIR, or bonk-cache in the system temporary directory.
+class DiskCache {
+public:
+  DiskCache();
+  static std::optional<uint64_t> hashFile(const std::string& filename);
+  // Key of the unit density and stiffness modal basis of a mesh
+  static uint64_t modalKey(uint64_t meshHash, const ModalOptions& options);
+  bool loadMesh(uint64_t key, MeshData& mesh) const;
+  void saveMesh(uint64_t key, const MeshData& mesh) const;
+  // Misses unless the cached modes have exactly rows rows
+  bool loadModal(uint64_t key, Eigen::Index rows, Eigen::VectorXd& freq, Eigen::MatrixXd& modes) const;
+  void saveModal(uint64_t key, const Eigen::VectorXd& freq, const Eigen::MatrixXd& modes) const;
+private:
+  std::filesystem::path pathFor(uint64_t key, const char* extension) const;
+  std::filesystem::path dir;
+};
@@ -0,0 +1,184 @@
+#include "modal.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BONK_X86 1
+#endif
+
+// Modes are extinct below this amplitude
+static constexpr double EXTINCTION {1e-8};
+// Samples synthesized between checks for extinct modes
+static constexpr int BLOCK {256};
+// Lanes are padded to a multiple of the widest kernel's step, two AVX-512 vectors
+static constexpr size_t PADDING {16};
+
+static size_t padded(size_t n) {
+  return (n + PADDING - 1) / PADDING * PADDING;
+}
+
+// Each kernel runs count <= BLOCK samples of n lanes (a multiple of PADDING), leaving per-sample sums
+// of the imaginary parts in lanes as count rows of its vector width, and advancing the state in place.
+// Two vectors of modes are stepped per pass so their dependency chains overlap.
+
+static void runScalar(double* re, double* im, const double* rotRe, const double* rotIm, size_t n, int count, double* lanes) {
+  constexpr size_t W = 4;
+  std::fill(lanes, lanes + count * W, 0.0);
+  for (size_t g = 0; g < n; g += W) {
+    double r[W], i[W], cr[W], ci[W];
+    for (size_t l = 0; l < W; l++) {
+      r[l] = re[g + l]; i[l] = im[g + l]; cr[l] = rotRe[g + l]; ci[l] = rotIm[g + l];
+    }
+    for (int s = 0; s < count; s++) {
+      for (size_t l = 0; l < W; l++) {
+        lanes[s * W + l] += i[l];
+        double nr = r[l] * cr[l] - i[l] * ci[l];
+        i[l] = r[l] * ci[l] + i[l] * cr[l];
+        r[l] = nr;
+      }
+    }
+    for (size_t l = 0; l < W; l++) {
+      re[g + l] = r[l]; im[g + l] = i[l];
+    }
+  }
+}
+
+#if defined(BONK_X86)
+__attribute__((target("avx2,fma")))
+static void runAvx2(double* re, double* im, const double* rotRe, const double* rotIm, size_t n, int count, double* lanes) {
+  constexpr size_t W = 4;
+  for (int s = 0; s < count; s++) {
+    _mm256_storeu_pd(lanes + s * W, _mm256_setzero_pd());
+  }
+  for (size_t g = 0; g < n; g += 2 * W) {
+    __m256d r0 = _mm256_loadu_pd(re + g), r1 = _mm256_loadu_pd(re + g + W);
+    __m256d i0 = _mm256_loadu_pd(im + g), i1 = _mm256_loadu_pd(im + g + W);
+    __m256d cr0 = _mm256_loadu_pd(rotRe + g), cr1 = _mm256_loadu_pd(rotRe + g + W);
+    __m256d ci0 = _mm256_loadu_pd(rotIm + g), ci1 = _mm256_loadu_pd(rotIm + g + W);
+    for (int s = 0; s < count; s++) {
+      __m256d sum = _mm256_add_pd(_mm256_loadu_pd(lanes + s * W), _mm256_add_pd(i0, i1));
+      _mm256_storeu_pd(lanes + s * W, sum);
+      __m256d nr0 = _mm256_fmsub_pd(r0, cr0, _mm256_mul_pd(i0, ci0));
+      __m256d nr1 = _mm256_fmsub_pd(r1, cr1, _mm256_mul_pd(i1, ci1));
+      i0 = _mm256_fmadd_pd(r0, ci0, _mm256_mul_pd(i0, cr0));
+      i1 = _mm256_fmadd_pd(r1, ci1, _mm256_mul_pd(i1, cr1));
+      r0 = nr0;
+      r1 = nr1;
+    }
+    _mm256_storeu_pd(re + g, r0); _mm256_storeu_pd(re + g + W, r1);
+    _mm256_storeu_pd(im + g, i0); _mm256_storeu_pd(im + g + W, i1);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void runAvx512(double* re, double* im, const double* rotRe, const double* rotIm, size_t n, int count, double* lanes) {
+  constexpr size_t W = 8;
+  for (int s = 0; s < count; s++) {
+    _mm512_storeu_pd(lanes + s * W, _mm512_setzero_pd());
+  }
+  for (size_t g = 0; g < n; g += 2 * W) {
+    __m512d r0 = _mm512_loadu_pd(re + g), r1 = _mm512_loadu_pd(re + g + W);
+    __m512d i0 = _mm512_loadu_pd(im + g), i1 = _mm512_loadu_pd(im + g + W);
+    __m512d cr0 = _mm512_loadu_pd(rotRe + g), cr1 = _mm512_loadu_pd(rotRe + g + W);
+    __m512d ci0 = _mm512_loadu_pd(rotIm + g), ci1 = _mm512_loadu_pd(rotIm + g + W);
+    for (int s = 0; s < count; s++) {
+      __m512d sum = _mm512_add_pd(_mm512_loadu_pd(lanes + s * W), _mm512_add_pd(i0, i1));
+      _mm512_storeu_pd(lanes + s * W, sum);
+      __m512d nr0 = _mm512_fmsub_pd(r0, cr0, _mm512_mul_pd(i0, ci0));
+      __m512d nr1 = _mm512_fmsub_pd(r1, cr1, _mm512_mul_pd(i1, ci1));
+      i0 = _mm512_fmadd_pd(r0, ci0, _mm512_mul_pd(i0, cr0));
+      i1 = _mm512_fmadd_pd(r1, ci1, _mm512_mul_pd(i1, cr1));
+      r0 = nr0;
+      r1 = nr1;
+    }
+    _mm512_storeu_pd(re + g, r0); _mm512_storeu_pd(re + g + W, r1);
+    _mm512_storeu_pd(im + g, i0); _mm512_storeu_pd(im + g + W, i1);
+  }
+}
+#endif
+
+using Kernel = void (*)(double*, double*, const double*, const double*, size_t, int, double*);
+
+struct KernelChoice {
+  Kernel run;
+  size_t width;
+};
+
+static KernelChoice pickKernel() {
+#if defined(BONK_X86)
+  if (__builtin_cpu_supports("avx512f")) {
+    return {runAvx512, 8};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {runAvx2, 4};
+  }
+#endif
+  return {runScalar, 4};
+}
+
+void ModalSynth::load(const V& amp, const V& phase, const V& phaseStep, const V& damp) {
+  modeCount = static_cast<size_t>(amp.size());
+  re.clear(); im.clear(); rotRe.clear(); rotIm.clear(); modeIndex.clear();
+  for (size_t j = 0; j < modeCount; j++) {
+    if (std::abs(amp[j]) <= EXTINCTION) {
+      continue;
+    }
+    re.push_back(amp[j] * std::cos(phase[j]));
+    im.push_back(amp[j] * std::sin(phase[j]));
+    rotRe.push_back(damp[j] * std::cos(phaseStep[j]));
+    rotIm.push_back(damp[j] * std::sin(phaseStep[j]));
+    modeIndex.push_back(static_cast<int>(j));
+  }
+  active = re.size();
+  size_t n = padded(active);
+  re.resize(n, 0.0); im.resize(n, 0.0); rotRe.resize(n, 0.0); rotIm.resize(n, 0.0); modeIndex.resize(n, -1);
+}
+
+void ModalSynth::compact() {
+  // Swap extinct lanes with the last active one and zero them, so the padding invariant holds
+  for (size_t l = 0; l < active;) {
+    if (re[l] * re[l] + im[l] * im[l] > EXTINCTION * EXTINCTION) {
+      l++;
+      continue;
+    }
+    size_t last = --active;
+    std::swap(re[l], re[last]); std::swap(im[l], im[last]);
+    std::swap(rotRe[l], rotRe[last]); std::swap(rotIm[l], rotIm[last]);
+    std::swap(modeIndex[l], modeIndex[last]);
+    re[last] = im[last] = rotRe[last] = rotIm[last] = 0.0;
+    modeIndex[last] = -1;
+  }
+}
+
+bool ModalSynth::run(double* out, int count) {
+  static const KernelChoice kernel = pickKernel();
+  lanes.resize(BLOCK * kernel.width);
+  for (int start = 0; start < count && active > 0; start += BLOCK) {
+    int n = std::min(BLOCK, count - start);
+    kernel.run(re.data(), im.data(), rotRe.data(), rotIm.data(), padded(active), n, lanes.data());
+    for (int s = 0; s < n; s++) {
+      double sum = 0.0;
+      for (size_t l = 0; l < kernel.width; l++) {
+        sum += lanes[s * kernel.width + l];
+      }
+      out[start + s] += sum;
+    }
+    compact();
+  }
+  return active > 0;
+}
+
+void ModalSynth::store(V& amp, V& phase) const {
+  amp.setZero(modeCount);
+  for (size_t l = 0; l < active; l++) {
+    int j = modeIndex[l];
+    amp[j] = std::hypot(re[l], im[l]);
+    phase[j] = std::atan2(im[l], re[l]);
+  }
+}
+
+size_t ModalSynth::bytes() const {
+  return (re.capacity() + im.capacity() + rotRe.capacity() + rotIm.capacity() + lanes.capacity()) * sizeof(double)
+    + modeIndex.capacity() * sizeof(int);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <eigen3/Eigen/Core>
+#include <vector>
+
+// Which eigenmodes initModalContext solves for
+enum class ModeSelection {
+  // Highest frequencies, the original behaviour
+  Largest,
+  // Lowest non-rigid modes, via shift-invert just below zero
+  Lowest,
+  // Modes between minFreq and maxFreq, via shift-invert at the window's center
+  Window
+};
+
+struct ModalOptions {
+  ModeSelection selection {ModeSelection::Largest};
+  // Modes to solve for, or the first batch when the count is adaptive
+  int modeCount {50};
+  // Hz, only for Window
+  double minFreq {0.0};
+  // Hz. Upper edge for Window. For Lowest, a positive value makes the count adaptive, growing
+  // until every mode below it is found or maxModes is reached.
+  double maxFreq {0.0};
+  int maxModes {400};
+};
+
+// Additive synthesis of exponentially decaying sinusoids. Each mode is a complex state rotated and
+// damped by a constant every sample, so its imaginary part traces amp * damp^n * sin(phase + n * step)
+// without calling sin. Modes live in a structure-of-arrays layout that is vectorized across modes,
+// and modes that have decayed away are compacted out so they stop costing anything.
+class ModalSynth {
+using V = Eigen::VectorXd;
+public:
+  // Loads every mode with nonzero amplitude. Rotation angles are in radians per sample.
+  void load(const V& amp, const V& phase, const V& phaseStep, const V& damp);
+  // Adds count samples of every active mode to out, returns whether any mode is still active
+  bool run(double* out, int count);
+  // Writes the state back as amplitude and phase, extinct modes get zero amplitude
+  void store(V& amp, V& phase) const;
+  size_t activeCount() const {return active;}
+  size_t bytes() const;
+private:
+  void compact();
+  // Padded to a whole number of vectors, padding lanes hold zeros and stay zero
+  std::vector<double> re {};
+  std::vector<double> im {};
+  std::vector<double> rotRe {};
+  std::vector<double> rotIm {};
+  // Original index of each lane
+  std::vector<int> modeIndex {};
+  size_t active {0};
+  size_t modeCount {0};
+  // Per-lane partial sums of one block of samples
+  std::vector<double> lanes {};
+};
@@ -0,0 +1,50 @@
+#include "model.hpp"
+
+template <typename T>
+static size_t vectorBytes(const std::vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+
+MeshModel::MeshModel(uint64_t hash, MeshData mesh) : hash{hash}, mesh{std::move(mesh)} {
+  vertCount = this->mesh.positions.size() / 3;
+  std::vector<float> threeVertices {};
+  threeVertices.reserve(3 * this->mesh.threeToLocal.size());
+  for (int local : this->mesh.threeToLocal) {
+    threeVertices.push_back(this->mesh.positions[3*local]);
+    threeVertices.push_back(this->mesh.positions[3*local+1]);
+    threeVertices.push_back(this->mesh.positions[3*local+2]);
+  }
+  vertices = std::make_shared<const std::vector<float>>(std::move(threeVertices));
+  indices = std::make_shared<const std::vector<uint32_t>>(this->mesh.threeIndices.begin(), this->mesh.threeIndices.end());
+}
+
+const Assembly& MeshModel::assembly() const {
+  std::call_once(assemblyOnce, [this] {
+    assembly_.build(mesh.positions, mesh.tets);
+    assemblyBuilt.store(true, std::memory_order_release);
+  });
+  return assembly_;
+}
+
+size_t MeshModel::bytes() const {
+  return vectorBytes(mesh.positions) + vectorBytes(mesh.tets) + vectorBytes(mesh.threeToLocal) + vectorBytes(mesh.threeIndices)
+    + vectorBytes(*vertices) + vectorBytes(*indices)
+    + (assemblyBuilt.load(std::memory_order_acquire) ? assembly_.bytes() : 0);
+}
+
+size_t ModalBasis::bytes() const {
+  return (unitFreq.size() + unitModes.size()) * sizeof(double);
+}
+
+size_t TunedModel::bytes() const {
+  return (freq.size() + phaseStep.size() + damp.size() + surfaceModes.size()) * sizeof(double);
+}
+
+ModelStore& ModelStore::shared() {
+  static ModelStore store {};
+  return store;
+}
+
+size_t ModelStore::bytes() {
+  return meshes.bytes() + bases.bytes() + tuned.bytes();
+}
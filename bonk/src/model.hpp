@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <eigen3/Eigen/Core>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include "assembly.hpp"
+#include "cache.hpp"
+
+// The parts of a model that never change once built, shared between every BonkInstance using the
+// same mesh, basis or tuning through ModelStore. Only amplitude, phase and output are per instance.
+
+// A meshed file and its surface in three.js layout
+class MeshModel {
+public:
+  MeshModel(uint64_t hash, MeshData mesh);
+  uint64_t hash;
+  MeshData mesh;
+  size_t vertCount;
+  std::shared_ptr<const std::vector<float>> vertices;
+  std::shared_ptr<const std::vector<uint32_t>> indices;
+  // Built by the first instance that needs it, safe to call from several at once
+  const Assembly& assembly() const;
+  size_t bytes() const;
+private:
+  mutable std::once_flag assemblyOnce {};
+  mutable Assembly assembly_ {};
+  mutable std::atomic<bool> assemblyBuilt {false};
+};
+
+// Modes of a mesh for unit density and k, with frequencies in Hz
+struct ModalBasis {
+  Eigen::VectorXd unitFreq;
+  Eigen::MatrixXd unitModes;
+  size_t bytes() const;
+};
+
+// A basis retuned for one material, damping and time step: everything bonk and runModal read
+struct TunedModel {
+  // Hz, radians per sample and decay per sample
+  Eigen::VectorXd freq, phaseStep, damp;
+  // Rows of the modes for the surface vertices only, in three.js order and contiguous per vertex so a
+  // bonk touches only the rows of the vertices it hits
+  Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> surfaceModes;
+  size_t bytes() const;
+};
+
+// Process-wide lookup of the shared model parts that are still referenced by some instance. Entries
+// don't keep anything alive themselves, the last instance to let go of a part frees it.
+class ModelStore {
+public:
+  using TunedKey = std::tuple<uint64_t, double, double, double, double, double>;
+  static ModelStore& shared();
+  std::shared_ptr<const MeshModel> findMesh(uint64_t hash) {return meshes.find(hash);}
+  std::shared_ptr<const ModalBasis> findBasis(uint64_t modalKey) {return bases.find(modalKey);}
+  std::shared_ptr<const TunedModel> findTuned(const TunedKey& key) {return tuned.find(key);}
+  // Each returns the entry already stored under the key if another instance got there first
+  std::shared_ptr<const MeshModel> addMesh(uint64_t hash, std::shared_ptr<const MeshModel> mesh) {return meshes.add(hash, std::move(mesh));}
+  std::shared_ptr<const ModalBasis> addBasis(uint64_t modalKey, std::shared_ptr<const ModalBasis> basis) {return bases.add(modalKey, std::move(basis));}
+  std::shared_ptr<const TunedModel> addTuned(const TunedKey& key, std::shared_ptr<const TunedModel> model) {return tuned.add(key, std::move(model));}
+  // Of everything live, each part counted once however many instances share it
+  size_t bytes();
+private:
+  template <typename Key, typename T>
+  class Table {
+  public:
+    std::shared_ptr<const T> find(const Key& key) {
+      std::lock_guard lock {mutex};
+      auto it = entries.find(key);
+      return it == entries.end() ? nullptr : it->second.lock();
+    }
+    std::shared_ptr<const T> add(const Key& key, std::shared_ptr<const T> value) {
+      std::lock_guard lock {mutex};
+      std::erase_if(entries, [](const auto& entry) {return entry.second.expired();});
+      auto [it, inserted] = entries.try_emplace(key, value);
+      if (!inserted) {
+        if (auto existing = it->second.lock()) {return existing;}
+        it->second = value;
+      }
+      return value;
+    }
+    size_t bytes() {
+      std::lock_guard lock {mutex};
+      size_t total {0};
+      for (auto& [key, weak] : entries) {
+        if (auto value = weak.lock()) {total += value->bytes();}
+      }
+      return total;
+    }
+  private:
+    std::mutex mutex {};
+    std::map<Key, std::weak_ptr<const T>> entries {};
+  };
+  Table<uint64_t, MeshModel> meshes {};
+  Table<uint64_t, ModalBasis> bases {};
+  Table<TunedKey, TunedModel> tuned {};
+};
@@ -1,9 +1,15 @@
 #include "tet.hpp"
+#include <algorithm>
 #include <filesystem>
 #include <iterator>
+#include <limits>
 #include <numbers>
 
 #define SURFACE_MESH_MAX_VERTICES 2500
+// Samples runModal produces between checks for cancellation
+#define RUN_CANCEL_CHUNK 48000
+// Delayed hits an instance holds before bonk refuses more
+#define MAX_PENDING_VOICES 256
 
 bool BonkInstance::detectAndFillHoles(Polyhedron poly) {
   std::vector<boost::graph_traits<Polyhedron>::halfedge_descriptor> border_cycles {};
@@ -24,6 +30,25 @@ BonkInstance::BonkResult BonkInstance::loadMesh(std::string filename) {
   if (!std::filesystem::exists(p)) {
     return BonkResult::FileOpenFailure;
   }
+  auto hash = DiskCache::hashFile(filename);
+  if (!hash) {
+    return BonkResult::FileOpenFailure;
+  }
+  isThreeReady = false;
+  model = nullptr;
+  basis = nullptr;
+  tuned = nullptr;
+  // Meshing only depends on the file contents, so another instance's mesh or a cached one skips
+  // CGAL entirely
+  auto& store = ModelStore::shared();
+  if ((model = store.findMesh(*hash))) {
+    return BonkResult::Success;
+  }
+  MeshData cached {};
+  if (cache.loadMesh(*hash, cached)) {
+    model = store.addMesh(*hash, std::make_shared<const MeshModel>(*hash, std::move(cached)));
+    return BonkResult::Success;
+  }
   Polyhedron poly;
   Mesh m;
   CGAL::IO::read_polygon_mesh(filename, m);
@@ -35,6 +60,7 @@ BonkInstance::BonkResult BonkInstance::loadMesh(std::string filename) {
   if (!noHoles) {
     return BonkResult::FileOpenFailure;
   }
+  if (cancelled()) {return BonkResult::Cancelled;}
   if (!CGAL::Polygon_mesh_processing::is_outward_oriented(poly)) {
     CGAL::Polygon_mesh_processing::orient(poly);
   }
@@ -42,9 +68,11 @@ BonkInstance::BonkResult BonkInstance::loadMesh(std::string filename) {
     StopPredicate stop(SURFACE_MESH_MAX_VERTICES);
     CGAL::Surface_mesh_simplification::edge_collapse(poly, stop, CGAL::parameters::vertex_index_map(get(CGAL::vertex_external_index, poly)).halfedge_index_map(get(CGAL::halfedge_external_index, poly)));
   }
+  if (cancelled()) {return BonkResult::Cancelled;}
   if (CGAL::Polygon_mesh_processing::does_self_intersect<CGAL::Parallel_if_available_tag>(poly, CGAL::parameters::vertex_point_map(get(CGAL::vertex_point, poly)))) {
     return BonkResult::FileOpenFailure;
   }
+  if (cancelled()) {return BonkResult::Cancelled;}
   Domain domain(poly);
   auto bb = CGAL::Polygon_mesh_processing::bbox(poly);
   auto bb_size = std::sqrt(std::pow(bb.x_span(), 2) + std::pow(bb.y_span(), 2) + std::pow(bb.z_span(), 2));
@@ -56,31 +84,41 @@ BonkInstance::BonkResult BonkInstance::loadMesh(std::string filename) {
     CGAL::parameters::cell_radius_edge_ratio(2.0),
     CGAL::parameters::cell_size(max_facet_size)
   );
-  complex = CGAL::make_mesh_3<MeshComplex>(domain, criteria);
+  auto complex = CGAL::make_mesh_3<MeshComplex>(domain, criteria);
+  if (cancelled()) {return BonkResult::Cancelled;}
   complex.remove_isolated_vertices();
   if (complex.number_of_cells_in_complex() == 0) {
     return BonkResult::FileOpenFailure;
   }
-  int idx {0};
+  auto mesh = extractMesh(complex);
+  cache.saveMesh(*hash, mesh);
+  model = store.addMesh(*hash, std::make_shared<const MeshModel>(*hash, std::move(mesh)));
+  return BonkResult::Success;
+}
+
+MeshData BonkInstance::extractMesh(MeshComplex& complex) {
+  MeshData result {};
+  std::unordered_map<Triangulation::Vertex_handle, int> handlesToInds {};
+  auto localIndex = [&](Triangulation::Vertex_handle v) {
+    auto [it, inserted] = handlesToInds.try_emplace(v, static_cast<int>(handlesToInds.size()));
+    if (inserted) {
+      auto p = v->point();
+      result.positions.push_back(CGAL::to_double(p.x()));
+      result.positions.push_back(CGAL::to_double(p.y()));
+      result.positions.push_back(CGAL::to_double(p.z()));
+    }
+    return it->second;
+  };
   for (auto cell = complex.cells_in_complex_begin(); cell != complex.cells_in_complex_end(); ++cell) {
+    bool solid = complex.subdomain_index(cell) != 0; // Gemini
     for (int i = 0; i < 4; i++) {
-      auto v = cell->vertex(i);
-      if (handles_to_inds.find(v) == handles_to_inds.end()) {
-        handles_to_inds[v] = idx;
-        inds_to_handles.push_back(v);
-        idx++;
+      int local = localIndex(cell->vertex(i));
+      if (solid) {
+        result.tets.push_back(local);
       }
     }
   }
-  vert_count = static_cast<size_t>(idx);
-  isTetMesh = true;
-  return BonkResult::Success;
-}
-
-BonkInstance::BonkResult BonkInstance::prepareThree() {
-  if (!isTetMesh) {return BonkResult::BadInvocation;}
   std::unordered_map<int, int> localToThree {};
-  int threeIndex {0};
   for (auto facet = complex.facets_in_complex_begin(); facet != complex.facets_in_complex_end(); ++facet) {
     auto cell = facet->first;
     auto opposite_vertex_index = facet->second;
@@ -94,20 +132,20 @@ BonkInstance::BonkResult BonkInstance::prepareThree() {
     }
     // end
     for (int k = 0; k < 3; k++) {
-      auto v = cell->vertex(faceIndices[k]);
-      int local = handles_to_inds[v];
-      if (localToThree.find(local) == localToThree.end()) {
-        auto p = v->point();
-        vertices.push_back(CGAL::to_double(p.x()));
-        vertices.push_back(CGAL::to_double(p.y()));
-        vertices.push_back(CGAL::to_double(p.z()));
-        localToThree[local] = threeIndex;
-        three_to_local[threeIndex] = local;
-        threeIndex++;
+      int local = localIndex(cell->vertex(faceIndices[k]));
+      auto [it, inserted] = localToThree.try_emplace(local, static_cast<int>(result.threeToLocal.size()));
+      if (inserted) {
+        result.threeToLocal.push_back(local);
       }
-      indices.push_back(localToThree[local]);
+      result.threeIndices.push_back(it->second);
     }
   }
+  return result;
+}
+
+BonkInstance::BonkResult BonkInstance::prepareThree() {
+  if (!model) {return BonkResult::BadInvocation;}
+  // The three.js arrays are part of the shared model, built along with it
   isThreeReady = true;
   return BonkResult::Success;
 }
@@ -122,22 +160,21 @@ double getJustNoticableDifference(double freq) {
   return freq / 100.0;
 }
 
-void BonkInstance::calcPhase(double damping, double freqDamping) {
-  phase.resizeLike(freq);  phase.setZero();
-  damp.resizeLike(freq);  damp.setZero();
-  phase_step.resizeLike(freq);  phase_step.setZero();
-  amp.resizeLike(freq);  amp.setZero();
+void BonkInstance::calcPhase(TunedModel& out, double damping, double freqDamping, double dt) const {
+  auto& freq = out.freq;
+  out.damp.resizeLike(freq);  out.damp.setZero();
+  out.phaseStep.resizeLike(freq);  out.phaseStep.setZero();
   for (int i = 0; i < freq.size(); i++) {
-    phase_step[i] = freq[i] * dt;
+    // freq is in Hz and the synth rotates by radians per sample
+    out.phaseStep[i] = 2.0 * std::numbers::pi * freq[i] * dt;
     double d = damping + (freq[i] * freqDamping);
-    damp[i] = std::exp(-d * dt);
+    out.damp[i] = std::exp(-d * dt);
   }
 }
 
-void BonkInstance::compressModesAndCalcPhase(double damping, double freqDamping) {
+std::vector<Eigen::Index> BonkInstance::mergeModes(V& freq) const {
+  std::vector<Eigen::Index> starts {0};
   std::vector<double> temp_freq {};
-  std::vector<V> temp_modes {};
-  V mode_sum = modes.col(0);
   double freq_sum = freq[0];
   int count {1};
   auto start_f = freq[0];
@@ -146,121 +183,308 @@ void BonkInstance::compressModesAndCalcPhase(double damping, double freqDamping)
     auto f_prev = freq[i-1];
     auto limit = getJustNoticableDifference(f_prev) * 2;
     if (std::abs(f - f_prev) < limit && std::abs(f - start_f) < limit * 2) {
-      mode_sum += modes.col(i);
       freq_sum += f;
       count++;
     } else {
       temp_freq.push_back(freq_sum / count);
-      temp_modes.push_back(mode_sum / std::sqrt(count));
-      mode_sum = modes.col(i);
+      starts.push_back(i);
       freq_sum = f;
       count = 1;
       start_f = freq[i];
     }
   }
   temp_freq.push_back(freq_sum / count);
-  temp_modes.push_back(mode_sum / std::sqrt(count));
-  auto n_modes = temp_freq.size();
-  freq.resize(n_modes);
-  modes.resize(3*vert_count, n_modes);
-  for (int i = 0; i < n_modes; ++i) {
-    freq[i] = temp_freq[i];
-    modes.col(i) = temp_modes[i];
-  }
-  calcPhase(damping, freqDamping);
+  starts.push_back(freq.size());
+  freq = Eigen::Map<V>(temp_freq.data(), temp_freq.size());
+  return starts;
 }
 
-BonkInstance::BonkResult BonkInstance::initModalContext(double density, double k, double dt, double damping, double freqDamping) {
-  if (!isTetMesh) {return BonkResult::BadInvocation;}
-  this->density = density;
-  this->dt = dt;
-  auto K = SpMat(3*vert_count, 3*vert_count);
-  auto M = SpMat(3*vert_count, 3*vert_count);
-  std::vector<T> kTriplets {};
-  std::vector<T> mTriplets {};
-  auto triangulation = complex.triangulation();
-  for (auto cell = complex.cells_in_complex_begin(); cell != complex.cells_in_complex_end(); ++cell) {
-    if (complex.subdomain_index(cell) == 0) {continue;} // Gemini
-    double vol = std::abs(triangulation.tetrahedron(cell).volume());
-    auto m = density * vol / 4;
-    for (int i = 0; i < 4; i++){
-      int u = handles_to_inds[cell->vertex(i)];
-      mTriplets.push_back(T(3*u+0, 3*u+0, m)); 
-      mTriplets.push_back(T(3*u+1, 3*u+1, m)); 
-      mTriplets.push_back(T(3*u+2, 3*u+2, m)); 
-      for (int j = i + 1; j < 4; j++) {
-        int v = handles_to_inds[cell->vertex(j)];
-        for (int k_ = 0; k_ < 3; k_++) {
-          int u_ = 3*u+k_;
-          int v_ = 3*v+k_;
-          kTriplets.push_back(T(u_, u_, k));
-          kTriplets.push_back(T(v_, v_, k));
-
-          kTriplets.push_back(T(u_, v_, -k));
-          kTriplets.push_back(T(v_, u_, -k));
+void BonkInstance::buildSurfaceModes(TunedModel& out, const std::vector<Eigen::Index>& starts, double scale) const {
+  auto& threeToLocal = model->mesh.threeToLocal;
+  auto& unitModes = basis->unitModes;
+  auto modeCount = static_cast<Eigen::Index>(starts.size()) - 1;
+  out.surfaceModes.setZero(3 * threeToLocal.size(), modeCount);
+  for (Eigen::Index m = 0; m < modeCount; m++) {
+    // A merged mode is its run of unit modes summed and divided by the square root of their count
+    double weight = scale / std::sqrt(static_cast<double>(starts[m + 1] - starts[m]));
+    for (Eigen::Index col = starts[m]; col < starts[m + 1]; col++) {
+      const double* unit = unitModes.col(col).data();
+      for (size_t t = 0; t < threeToLocal.size(); t++) {
+        const double* row = unit + 3 * threeToLocal[t];
+        for (int c = 0; c < 3; c++) {
+          out.surfaceModes(3 * t + c, m) += weight * row[c];
         }
       }
     }
   }
-  K.setFromTriplets(kTriplets.begin(), kTriplets.end());
-  M.setFromTriplets(mTriplets.begin(), mTriplets.end());
+}
+
+BonkInstance::BonkResult BonkInstance::initModalContext(double density, double k, double dt, double damping, double freqDamping, ModalOptions options) {
+  if (!model) {return BonkResult::BadInvocation;}
+  if (options.modeCount <= 0 || (options.selection == ModeSelection::Window && !(options.minFreq < options.maxFreq))) {
+    return BonkResult::BadInvocation;
+  }
+  if (!(density > 0) || !(k > 0)) {return BonkResult::BadInvocation;}
+  tuned = nullptr;
+  // The basis is solved for unit density and k, where every frequency is sqrt(density / k) times
+  // what it will be once retuned
+  ModalOptions unitOptions = options;
+  unitOptions.minFreq *= std::sqrt(density / k);
+  unitOptions.maxFreq *= std::sqrt(density / k);
+  auto key = DiskCache::modalKey(model->hash, unitOptions);
+  auto& store = ModelStore::shared();
+  auto found = store.findBasis(key);
+  if (!found) {
+    auto solved = std::make_shared<ModalBasis>();
+    auto rows = static_cast<Eigen::Index>(3 * model->vertCount);
+    if (!cache.loadModal(key, rows, solved->unitFreq, solved->unitModes)) {
+      auto& assembly = model->assembly();
+      if (cancelled()) {return BonkResult::Cancelled;}
+      SpMat K = assembly.stiffness(1.0);
+      SpMat M = Assembly::diagonal(assembly.massDiagonal(1.0));
+      auto res = unitOptions.selection == ModeSelection::Largest
+        ? solveLargest(K, M, std::min(unitOptions.modeCount, static_cast<int>(model->vertCount)), *solved)
+        : solveShiftInvert(K, M, unitOptions, *solved);
+      if (res != BonkResult::Success) {
+        return res;
+      }
+      if (cancelled()) {return BonkResult::Cancelled;}
+      // Eigenvalues are squared angular frequencies
+      auto& unitFreq = solved->unitFreq;
+      for (int i = 0; i < static_cast<int>(unitFreq.size()); i++) {
+        auto f = unitFreq[i] > 0 ? std::sqrt(unitFreq[i]) : 0.0;
+        unitFreq[i] = f / (2.0 * std::numbers::pi);
+      }
+      cache.saveModal(key, solved->unitFreq, solved->unitModes);
+    }
+    found = store.addBasis(key, std::move(solved));
+  }
+  basis = std::move(found);
+  modalKey = key;
+  return retune(density, k, damping, freqDamping, dt);
+}
+
+BonkInstance::BonkResult BonkInstance::retune(double density, double k, double damping, double freqDamping, double dt) {
+  if (!basis || !(density > 0) || !(k > 0)) {return BonkResult::BadInvocation;}
+  auto& store = ModelStore::shared();
+  ModelStore::TunedKey key {modalKey, density, k, damping, freqDamping, dt};
+  auto found = store.findTuned(key);
+  if (!found) {
+    // K scales by k and M by density, so eigenvalues scale by k / density, and mass-normalized
+    // modes by 1 / sqrt(density). Only the surface rows of the modes are ever read, so the scaled
+    // full basis is never built.
+    auto built = std::make_shared<TunedModel>();
+    built->freq = basis->unitFreq * std::sqrt(k / density);
+    auto starts = mergeModes(built->freq);
+    calcPhase(*built, damping, freqDamping, dt);
+    buildSurfaceModes(*built, starts, 1.0 / std::sqrt(density));
+    found = store.addTuned(key, std::move(built));
+  }
+  tuned = std::move(found);
+  this->dt = dt;
+  silence();
+  return BonkResult::Success;
+}
+
+void BonkInstance::silence() {
+  auto modeCount = tuned ? tuned->freq.size() : 0;
+  amp.setZero(modeCount);
+  phase.setZero(modeCount);
+  pendingVoices.clear();
+}
+
+void BonkInstance::excite(const V& hit) {
+  for (Eigen::Index i = 0; i < hit.size(); i++) {
+    double re = amp[i] * std::cos(phase[i]) + hit[i];
+    double im = amp[i] * std::sin(phase[i]);
+    amp[i] = std::hypot(re, im);
+    phase[i] = std::atan2(im, re);
+  }
+}
+
+BonkInstance::BonkResult BonkInstance::solveLargest(const SpMat& K, const SpMat& M, int desiredModes, ModalBasis& out) {
   Spectra::SparseSymMatProd<double> opK(K);
   Spectra::SparseCholesky<double> opM(M);
-  auto desired_modes = std::min(MODES, static_cast<int>(vert_count));
-  auto ncv = std::min(desired_modes * 2 + 1, 3*static_cast<int>(vert_count)); // Gemini
-  Spectra::SymGEigsSolver<Spectra::SparseSymMatProd<double>, Spectra::SparseCholesky<double>, Spectra::GEigsMode::Cholesky> eigs(opK, opM, desired_modes, ncv);
+  auto ncv = std::min(desiredModes * 2 + 1, 3*static_cast<int>(model->vertCount)); // Gemini
+  Spectra::SymGEigsSolver<Spectra::SparseSymMatProd<double>, Spectra::SparseCholesky<double>, Spectra::GEigsMode::Cholesky> eigs(opK, opM, desiredModes, ncv);
 
   eigs.init();
-  int nconv = eigs.compute(Spectra::SortRule::LargestMagn);
+  eigs.compute(Spectra::SortRule::LargestMagn);
   if (eigs.info() != Spectra::CompInfo::Successful) {
     return BonkResult::ModalSetupFailure;
   }
+  out.unitFreq = eigs.eigenvalues();
+  out.unitModes = eigs.eigenvectors();
+  return BonkResult::Success;
+}
+
+BonkInstance::BonkResult BonkInstance::solveShiftInvert(const SpMat& K, const SpMat& M, const ModalOptions& options, ModalBasis& out) {
+  using OpType = Spectra::SymShiftInvert<double, Eigen::Sparse, Eigen::Sparse>;
+  using BOpType = Spectra::SparseSymMatProd<double>;
+  int n = 3*static_cast<int>(model->vertCount);
+  // K only penalizes relative motion, so translations are free and have zero eigenvalue
+  constexpr int RIGID_MODES {3};
+  // Typical eigenvalue magnitude, to place the shift and tell rigid modes from real ones
+  double scale = (K.diagonal().array() / M.diagonal().array()).mean();
+  double rigidLimit = 1e-8 * scale;
 
-  freq = eigs.eigenvalues();
-  modes = eigs.eigenvectors();
-  for (int i = 0; i < static_cast<int>(freq.size()); i++) {
-    auto f = freq[i] > 0 ? std::sqrt(freq[i]) : 0.0;
-    freq[i] = f / (2.0 * std::numbers::pi);
+  auto toEigenvalue = [](double f) {return std::pow(2.0 * std::numbers::pi * f, 2);};
+  double sigma {0.0};
+  double lower {rigidLimit};
+  double upper {std::numeric_limits<double>::infinity()};
+  if (options.selection == ModeSelection::Window) {
+    sigma = toEigenvalue((options.minFreq + options.maxFreq) / 2);
+    lower = std::max(lower, toEigenvalue(options.minFreq));
+    upper = toEigenvalue(options.maxFreq);
+  } else {
+    // Just below zero, since K itself is singular
+    sigma = -1e-6 * scale;
+    if (options.maxFreq > 0) {
+      upper = toEigenvalue(options.maxFreq);
+    }
   }
+  bool adaptive = options.selection == ModeSelection::Lowest && options.maxFreq > 0;
 
-  compressModesAndCalcPhase(damping, freqDamping);
-  isBonkable = true;
-  return BonkResult::Success;
+  OpType op(K, M);
+  BOpType opM(M);
+  int nev = options.modeCount + (options.selection == ModeSelection::Lowest ? RIGID_MODES : 0);
+  while (true) {
+    nev = std::min(nev, n - 1);
+    auto ncv = std::min(nev * 2 + 1, n);
+    Spectra::SymGEigsShiftSolver<OpType, BOpType, Spectra::GEigsMode::ShiftInvert> eigs(op, opM, nev, ncv, sigma);
+    eigs.init();
+    eigs.compute(Spectra::SortRule::LargestMagn);
+    if (eigs.info() != Spectra::CompInfo::Successful) {
+      return BonkResult::ModalSetupFailure;
+    }
+    V values = eigs.eigenvalues();
+    Eigen::MatrixXd vectors = eigs.eigenvectors();
+
+    // Ascending, dropping rigid modes and anything outside the window or above the ceiling
+    std::vector<int> order {};
+    for (int i = 0; i < static_cast<int>(values.size()); i++) {
+      if (values[i] > lower && values[i] <= upper) {
+        order.push_back(i);
+      }
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {return values[a] < values[b];});
+
+    // Grow until the ceiling is passed, i.e. some mode was solved for but rejected as too high
+    bool reachedCeiling = values.size() > 0 && values.maxCoeff() > upper;
+    if (adaptive && !reachedCeiling && nev < std::min(options.maxModes + RIGID_MODES, n - 1)) {
+      nev = std::min(nev * 2, options.maxModes + RIGID_MODES);
+      if (cancelled()) {return BonkResult::Cancelled;}
+      continue;
+    }
+
+    if (order.empty()) {
+      return BonkResult::ModalSetupFailure;
+    }
+    if (adaptive && static_cast<int>(order.size()) > options.maxModes) {
+      order.resize(options.maxModes);
+    }
+    out.unitFreq.resize(order.size());
+    out.unitModes.resize(n, order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      out.unitFreq[i] = values[order[i]];
+      out.unitModes.col(i) = vectors.col(order[i]);
+    }
+    return BonkResult::Success;
+  }
 }
 
 /* Arg 1: vector of all vertices to apply force to and normalized weight of force at that point (determined by e^-dist(v, center of force)), Arg 2: force direction */
-BonkInstance::BonkResult BonkInstance::bonk(std::vector<int> indices, std::vector<double> weights, std::array<double, 3> normalizedForceDirection) {
-  if (!isBonkable) {return BonkResult::BadInvocation;}
-  forces.resize(3*vert_count);
-  forces.setZero();
+BonkInstance::BonkResult BonkInstance::bonk(std::span<const uint32_t> indices, std::span<const double> weights, std::array<double, 3> normalizedForceDirection, int delay) {
+  if (!tuned || delay < 0) {return BonkResult::BadInvocation;}
+  if (delay > 0 && pendingVoices.size() >= MAX_PENDING_VOICES) {return BonkResult::BadInvocation;}
+  auto& surfaceModes = tuned->surfaceModes;
+  if (weights.size() != indices.size()) {return BonkResult::BadInvocation;}
+  for (uint32_t index : indices) {
+    if (3 * static_cast<Eigen::Index>(index) >= surfaceModes.rows()) {
+      return BonkResult::BadInvocation;
+    }
+  }
+  // Only surface vertices can be hit, so project through their rows alone
+  V hit = V::Zero(surfaceModes.cols());
   for (size_t i = 0; i < indices.size(); i++) {
-    auto trueIndex = three_to_local[indices[i]];
-    forces[3*trueIndex] = normalizedForceDirection[0] * weights[i];
-    forces[3*trueIndex+1] = normalizedForceDirection[1] * weights[i];
-    forces[3*trueIndex+2] = normalizedForceDirection[2] * weights[i];
+    for (int c = 0; c < 3; c++) {
+      hit += (normalizedForceDirection[c] * weights[i]) * surfaceModes.row(3*indices[i] + c).transpose();
+    }
+  }
+  if (delay == 0) {
+    excite(hit);
+    return BonkResult::Success;
   }
-  amp = modes.transpose() * forces;
+  auto at = std::upper_bound(pendingVoices.begin(), pendingVoices.end(), delay, [](int64_t start, const Voice& voice) {
+    return start < voice.start;
+  });
+  pendingVoices.insert(at, Voice {delay, std::move(hit)});
   return BonkResult::Success;
 }
 
 BonkInstance::BonkResult BonkInstance::runModal(int count) {
-  modalResults.assign(count, 0);
-  // Gemini
-  for (int i = 0; i < count; i++) {
-    for (int j = 0; j < static_cast<int>(freq.size()); j++) {
-      modalResults[i] += amp[j] * std::sin(phase[j]);
-      phase[j] += phase_step[j];
-      amp[j] *= damp[j];
-      if (amp[j] <= 1e-8) {
-        amp[j] = 0.0;
+  if (!tuned || count < 0) {return BonkResult::BadInvocation;}
+  // A view of the last results may still be alive in JS, in which case they get fresh storage
+  if (modalResults.use_count() > 1) {
+    modalResults = std::make_shared<std::vector<double>>();
+  }
+  modalResults->assign(count, 0);
+  synth.load(amp, phase, tuned->phaseStep, tuned->damp);
+  size_t started = 0;
+  // Keeps amp and phase current for the next call and for bonks in between, and moves the hits
+  // still to come to the start of the next call
+  auto finish = [&](int rendered) {
+    synth.store(amp, phase);
+    pendingVoices.erase(pendingVoices.begin(), pendingVoices.begin() + started);
+    for (auto& voice : pendingVoices) {
+      voice.start -= rendered;
+    }
+  };
+  bool ringing = true;
+  int pos = 0;
+  while (pos < count && (ringing || started < pendingVoices.size())) {
+    if (cancelled()) {
+      finish(pos);
+      return BonkResult::Cancelled;
+    }
+    if (started < pendingVoices.size() && pendingVoices[started].start <= pos) {
+      // Mixed in exactly at their first sample, then rendered together with everything else
+      synth.store(amp, phase);
+      while (started < pendingVoices.size() && pendingVoices[started].start <= pos) {
+        excite(pendingVoices[started++].amp);
       }
+      synth.load(amp, phase, tuned->phaseStep, tuned->damp);
     }
-  }
-  // end
-  for (int i = 0; i < static_cast<int>(amp.size()); i++) {
-    if (amp[i] != 0.0) {
-      return BonkResult::Success;
+    int end = std::min(RUN_CANCEL_CHUNK, count - pos) + pos;
+    if (started < pendingVoices.size()) {
+      end = static_cast<int>(std::min<int64_t>(end, pendingVoices[started].start));
     }
+    ringing = synth.run(modalResults->data() + pos, end - pos);
+    pos = end;
+  }
+  finish(count);
+  return ringing || !pendingVoices.empty() ? BonkResult::Success : BonkResult::ModalCompleteExtinction;
+}
+
+BonkInstance::MemoryUsage BonkInstance::memoryUsage() const {
+  MemoryUsage usage {};
+  usage.own = (amp.size() + phase.size() + modalResults->capacity()) * sizeof(double) + synth.bytes();
+  for (auto& voice : pendingVoices) {
+    usage.own += sizeof(Voice) + voice.amp.size() * sizeof(double);
+  }
+  usage.shared = (model ? model->bytes() : 0) + (basis ? basis->bytes() : 0) + (tuned ? tuned->bytes() : 0);
+  return usage;
+}
+
+BonkInstance::ModalState BonkInstance::modalState() const {
+  ModalState state {};
+  if (!tuned) {return state;}
+  auto modeCount = tuned->freq.size();
+  for (Eigen::Index i = 0; i < modeCount; i++) {
+    state.freq.push_back(tuned->freq[i]);
+    state.decay.push_back(-std::log(tuned->damp[i]) / dt);
+    state.amp.push_back(amp[i]);
+    state.phase.push_back(phase[i]);
   }
-  return BonkResult::ModalCompleteExtinction;
+  return state;
 }
@@ -27,11 +27,20 @@
 #include <CGAL/tags.h>
 #include <Spectra/MatOp/SparseCholesky.h>
 #include <Spectra/MatOp/SparseSymMatProd.h>
+#include <Spectra/MatOp/SymShiftInvert.h>
+#include <Spectra/SymGEigsShiftSolver.h>
 #include <Spectra/SymGEigsSolver.h>
 #include <Spectra/Util/GEigsMode.h>
 #include <eigen3/Eigen/Core>
 #include <eigen3/Eigen/Eigen>
+#include <atomic>
+#include <memory>
+#include <span>
 #include <unordered_map>
+#include "assembly.hpp"
+#include "cache.hpp"
+#include "modal.hpp"
+#include "model.hpp"
 
 class BonkInstance {
 using Kernel = CGAL::Exact_predicates_inexact_constructions_kernel;
@@ -45,7 +54,6 @@ using Mesh = CGAL::Surface_mesh<Point>;
 using StopPredicate = CGAL::Surface_mesh_simplification::Edge_count_stop_predicate<Polyhedron>;
 using SpMat = Eigen::SparseMatrix<double>;
 using V = Eigen::VectorXd;
-using T = Eigen::Triplet<double>;
 public:
   enum class BonkResult {
     Success,
@@ -54,41 +62,90 @@ public:
     BadInvocation,
     ModalSetupFailure,
     ModalSimulationFailure,
-    ModalCompleteExtinction
+    ModalCompleteExtinction,
+    // Stopped early by cancel(), which leaves the instance as a failure of the same call would
+    Cancelled,
+    // Another call on this instance is still running on the thread pool
+    Busy
+  };
+  // Current excitation in physical units, in the layout the streaming server's /api/sim/modal/:id takes
+  struct ModalState {
+    // Hz, as played by runModal
+    std::vector<double> freq;
+    // Per second
+    std::vector<double> decay;
+    std::vector<double> amp;
+    std::vector<double> phase;
+  };
+  // Bytes this instance holds alone, and bytes of the shared model parts it references
+  struct MemoryUsage {
+    size_t own;
+    size_t shared;
   };
   BonkInstance() = default; 
   BonkResult loadMesh(std::string filename);
   BonkResult prepareThree();
   bool threeReady() {return isThreeReady;}
-  //size_t getVertCount() {return vert_count;}
-  std::vector<int> getIndices() {return indices;}
-  std::vector<double> getVertices() {return vertices;}
-  BonkResult initModalContext(double density, double k, double dt, double damping = 0.05, double freqDamping = 0.01);
-  BonkResult bonk(std::vector<int> indices, std::vector<double> weights, std::array<double, 3> normalizedForceDirection);
+  // Shared rather than copied so JS typed arrays can view them directly. Once handed out they are
+  // replaced, never written to, so a view stays valid (and unchanged) for as long as JS holds it.
+  std::shared_ptr<const std::vector<uint32_t>> getIndices() {return isThreeReady ? model->indices : std::make_shared<const std::vector<uint32_t>>();}
+  std::shared_ptr<const std::vector<float>> getVertices() {return isThreeReady ? model->vertices : std::make_shared<const std::vector<float>>();}
+  BonkResult initModalContext(double density, double k, double dt, double damping = 0.05, double freqDamping = 0.01, ModalOptions options = {});
+  // Reuses the basis of the last initModalContext for new material and damping parameters, without
+  // solving again. Any ringing modes are silenced.
+  BonkResult retune(double density, double k, double damping, double freqDamping, double dt);
+  // Adds a hit to whatever is still ringing, starting delay samples after the end of the last
+  // runModal. Every hit drives the same tuned modes, so they all sum into one complex state and any
+  // number of overlapping hits costs a single synthesis pass.
+  BonkResult bonk(std::span<const uint32_t> indices, std::span<const double> weights, std::array<double, 3> normalizedForceDirection, int delay = 0);
+  // Stops every ringing mode and drops hits that have not started yet
+  void silence();
   BonkResult runModal(int count);
-  std::vector<double> getResults() {
+  std::shared_ptr<const std::vector<double>> getResults() {
     return modalResults;
   }
+  MemoryUsage memoryUsage() const;
+  // Empty until initModalContext succeeds. Hits that have not started yet are left out.
+  ModalState modalState() const;
+  // Asks a running loadMesh, initModalContext or runModal on another thread to stop at its next
+  // checkpoint. Sticks until resetCancel, so it can't be missed by a call that is just starting.
+  void cancel() {cancelRequested.store(true, std::memory_order_relaxed);}
+  void resetCancel() {cancelRequested.store(false, std::memory_order_relaxed);}
 private:
+  bool cancelled() const {return cancelRequested.load(std::memory_order_relaxed);}
   bool detectAndFillHoles(Polyhedron poly);
-  void compressModesAndCalcPhase(double damping, double freqDamping);
-  void calcPhase(double damping, double freqDamping);
-  bool isBonkable {false};
-  bool isTetMesh {false};
+  MeshData extractMesh(MeshComplex& complex);
+  BonkResult solveLargest(const SpMat& K, const SpMat& M, int desiredModes, ModalBasis& out);
+  BonkResult solveShiftInvert(const SpMat& K, const SpMat& M, const ModalOptions& options, ModalBasis& out);
+  // Merges each run of modes closer than a just noticeable difference into one at their mean frequency.
+  // Returns the first unit mode of each merged mode, followed by the unit mode count.
+  std::vector<Eigen::Index> mergeModes(V& freq) const;
+  void calcPhase(TunedModel& out, double damping, double freqDamping, double dt) const;
+  // Surface rows of the merged modes of the basis, times scale
+  void buildSurfaceModes(TunedModel& out, const std::vector<Eigen::Index>& starts, double scale) const;
+  // Adds a hit's mode amplitudes, at phase zero, to amp and phase
+  void excite(const V& hit);
+  // A hit waiting for runModal to reach it
+  struct Voice {
+    // Samples after the start of the next runModal
+    int64_t start;
+    V amp;
+  };
   bool isThreeReady {false};
-  MeshComplex complex;
-  std::unordered_map<Triangulation::Vertex_handle, int> handles_to_inds {};
-  std::vector<Triangulation::Vertex_handle> inds_to_handles {};
-  std::unordered_map<int, int> three_to_local {};
-  std::vector<int> indices {};
-  std::vector<double> vertices {};
-  std::vector<double> modalResults {};
-  size_t vert_count {0};
-  double density {1};
-  double dt;
-  // Modal
-  static constexpr int MODES {50};
-  V forces;
-  V freq, phase_step, amp, phase, damp;
-  Eigen::MatrixXd modes;
+  DiskCache cache {};
+  // Shared with every other instance on the same mesh, basis and tuning, see ModelStore
+  std::shared_ptr<const MeshModel> model {};
+  std::shared_ptr<const ModalBasis> basis {};
+  std::shared_ptr<const TunedModel> tuned {};
+  // Of the basis, for the modal cache and ModelStore
+  uint64_t modalKey {0};
+  // Of the current tuning
+  double dt {0.0};
+  // The only modal state of this instance's own
+  V amp, phase;
+  // By start, ties in the order they were bonked
+  std::vector<Voice> pendingVoices {};
+  ModalSynth synth;
+  std::shared_ptr<std::vector<double>> modalResults {std::make_shared<std::vector<double>>()};
+  std::atomic<bool> cancelRequested {false};
 };
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Builds and runs both benchmark suites, writing their results as JSON to bench-results/<commit>/ so
+# runs can be compared across commits. Extra arguments go to both executables, e.g.
+#   scripts/bench.sh --benchmark_filter=modal --benchmark_repetitions=5
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+commit=$(git rev-parse --short HEAD)
+if ! git diff --quiet HEAD; then
+    commit="$commit-dirty"
+fi
+out="bench-results/$commit"
+mkdir -p "$out"
+
+cmake -B build -DBUILD_BENCHMARKS=ON
+cmake --build build --target bonk_bench
+./build/bonk_bench --benchmark_out="$out/server.json" --benchmark_out_format=json \
+    --benchmark_context=commit="$commit" "$@"
+
+(cd bonk && npx cmake-js compile --CDBONK_BUILD_BENCHMARKS=ON)
+./bonk/build/Release/BonkBench --benchmark_out="$out/bonk.json" --benchmark_out_format=json \
+    --benchmark_context=commit="$commit" "$@"
+
+echo "Results in $out"
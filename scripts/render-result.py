@@ -25,6 +25,8 @@ if __name__ == "__main__":
         "stiffness": 5000,
         "damping": 0.1,
         "area": 1,
+        # Render as fast as possible instead of pacing to real time
+        "lookaheadMs": 0,
     }
 
     urllib3.request("PUT", "http://localhost:3000/api/sim/config/0", json=params)
@@ -0,0 +1,121 @@
+#include "audio_file.h"
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <limits>
+
+// Every header is this long whatever the length, so it can be rewritten in place. For .npy it must
+// also keep the data 64-byte aligned, and leaves room for a 20 digit shape.
+static constexpr size_t WAV_HEADER_SIZE = 58;
+static constexpr size_t NPY_HEADER_SIZE = 128;
+
+// Header fields are little-endian, like the samples, which assumes a little-endian machine as
+// BinaryFrameHeader does
+template <typename T>
+static char* put(char* dst, T value) {
+    std::memcpy(dst, &value, sizeof(T));
+    return dst + sizeof(T);
+}
+
+static char* put(char* dst, const char* tag) {
+    std::memcpy(dst, tag, 4);
+    return dst + 4;
+}
+
+std::optional<AudioFileFormat> AudioFileWriter::format_for(const std::string& path) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    if (extension == ".wav") {
+        return AudioFileFormat::Wav;
+    } else if (extension == ".npy") {
+        return AudioFileFormat::Npy;
+    }
+    return std::nullopt;
+}
+
+AudioFileWriter::~AudioFileWriter() {
+    if (this->file.is_open()) {
+        this->close();
+    }
+}
+
+bool AudioFileWriter::open(const std::string& path, AudioFileFormat format, int sample_rate) {
+    this->file.open(path, std::ios::binary | std::ios::trunc);
+    this->format = format;
+    this->sample_rate = sample_rate;
+    this->samples = 0;
+    this->failed = !this->file.is_open();
+    if (!this->failed) {
+        this->write_header();
+    }
+    return !this->failed;
+}
+
+bool AudioFileWriter::write(std::span<const float> samples) {
+    // WAV sizes are 32-bit byte counts
+    size_t max_samples = this->format == AudioFileFormat::Wav
+                             ? (std::numeric_limits<uint32_t>::max() - WAV_HEADER_SIZE) / sizeof(float)
+                             : std::numeric_limits<size_t>::max() / sizeof(float);
+    if (this->failed || samples.size() > max_samples - this->samples) {
+        this->failed = true;
+        return false;
+    }
+    this->file.write(reinterpret_cast<const char*>(samples.data()), samples.size_bytes());
+    this->samples += samples.size();
+    this->failed = !this->file.good();
+    return !this->failed;
+}
+
+bool AudioFileWriter::close() {
+    if (!this->failed) {
+        this->file.seekp(0);
+        this->write_header();
+    }
+    this->file.close();
+    this->failed = this->failed || this->file.fail();
+    return !this->failed;
+}
+
+size_t AudioFileWriter::samples_written() const {
+    return this->samples;
+}
+
+void AudioFileWriter::write_header() {
+    if (this->format == AudioFileFormat::Wav) {
+        auto data_bytes = static_cast<uint32_t>(this->samples * sizeof(float));
+        std::array<char, WAV_HEADER_SIZE> header{};
+        char* dst = header.data();
+        dst = put(dst, "RIFF");
+        dst = put<uint32_t>(dst, WAV_HEADER_SIZE - 8 + data_bytes);
+        dst = put(dst, "WAVE");
+        // The 18 byte fmt chunk with an empty extension, as formats other than integer PCM call for
+        dst = put(dst, "fmt ");
+        dst = put<uint32_t>(dst, 18);
+        dst = put<uint16_t>(dst, 3); // WAVE_FORMAT_IEEE_FLOAT
+        dst = put<uint16_t>(dst, 1);
+        dst = put<uint32_t>(dst, this->sample_rate);
+        dst = put<uint32_t>(dst, this->sample_rate * sizeof(float));
+        dst = put<uint16_t>(dst, sizeof(float));
+        dst = put<uint16_t>(dst, 32);
+        dst = put<uint16_t>(dst, 0);
+        // Required for anything but integer PCM
+        dst = put(dst, "fact");
+        dst = put<uint32_t>(dst, 4);
+        dst = put<uint32_t>(dst, static_cast<uint32_t>(this->samples));
+        dst = put(dst, "data");
+        put<uint32_t>(dst, data_bytes);
+        this->file.write(header.data(), header.size());
+    } else {
+        std::string dict = fmt::format("{{'descr': '<f4', 'fortran_order': False, 'shape': ({},), }}", this->samples);
+        // Magic, version 1.0 and the dict's length, then the dict padded with spaces to a newline
+        std::string header("\x93NUMPY\x01\x00", 8);
+        uint16_t dict_size = NPY_HEADER_SIZE - header.size() - sizeof(uint16_t);
+        header.append(reinterpret_cast<const char*>(&dict_size), sizeof(uint16_t));
+        header.append(dict);
+        header.resize(NPY_HEADER_SIZE - 1, ' ');
+        header.push_back('\n');
+        this->file.write(header.data(), header.size());
+    }
+    this->failed = this->failed || !this->file.good();
+}
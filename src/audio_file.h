@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+
+enum class AudioFileFormat {
+    // 32-bit float mono WAV
+    Wav,
+    // One-dimensional float32 NumPy array
+    Npy,
+};
+
+// Writes mono float samples to a file as they are produced, so a render never has to fit in memory.
+// The header is written up front with a length of zero and patched by close().
+class AudioFileWriter {
+  public:
+    // From the extension of path, .wav or .npy
+    static std::optional<AudioFileFormat> format_for(const std::string& path);
+
+    // Patches the header if close() wasn't called, but can't report failure
+    ~AudioFileWriter();
+
+    // False if the file can't be created
+    bool open(const std::string& path, AudioFileFormat format, int sample_rate);
+    // False once anything failed to write, or if the file would outgrow its format
+    bool write(std::span<const float> samples);
+    // Patches the header with the final length, false if anything failed along the way
+    bool close();
+    size_t samples_written() const;
+
+  private:
+    void write_header();
+
+    std::ofstream file;
+    AudioFileFormat format{AudioFileFormat::Wav};
+    int sample_rate{0};
+    size_t samples{0};
+    bool failed{false};
+};
@@ -0,0 +1,95 @@
+#include "config.h"
+
+#include <fmt/core.h>
+#include <vector>
+
+std::optional<std::string> parse_client_config(const nlohmann::json& json, ClientConfig& config) {
+    SimParams& params = config.params;
+    try {
+        params = {
+            .physics_sample_rate = json.at("physicsSampleRate"),
+            .physics_block_size = json.at("physicsBlockSize"),
+            .audio_sample_rate = json.at("audioSampleRate"),
+            .audio_block_size = json.at("audioBlockSize"),
+            .viz_sample_rate = json.at("vizSampleRate"),
+            .viz_block_size = json.at("vizBlockSize"),
+            .mass = json.at("mass"),
+            .stiffness = json.at("stiffness"),
+            .damping = json.at("damping"),
+            .area = json.at("area"),
+        };
+        if (params.physics_sample_rate <= 0 || params.physics_block_size <= 0 || params.audio_sample_rate <= 0 ||
+            params.audio_block_size <= 0 || params.viz_sample_rate <= 0 || params.viz_block_size <= 0) {
+            return "Sample rates and block sizes must be positive.";
+        }
+
+        // Stay at most this far ahead of playback so queued audio stays bounded
+        params.lookahead_ms = json.value("lookaheadMs", 250);
+
+        // Optional, older clients only know about the Euler integrator
+        std::string integrator = json.value("integrator", "euler");
+        if (integrator == "exact") {
+            params.integrator = Integrator::Exact;
+        } else if (integrator != "euler") {
+            return fmt::format("Unknown integrator \"{}\".", integrator);
+        }
+
+        // Optional, how samples are packed on the stream. Delta coding only pays off for viz.
+        std::string audio_encoding = json.value("audioEncoding", "f32");
+        std::string viz_encoding = json.value("vizEncoding", "f32");
+        auto parsed_audio_encoding = parse_sample_encoding(audio_encoding);
+        auto parsed_viz_encoding = parse_sample_encoding(viz_encoding);
+        if (!parsed_audio_encoding || *parsed_audio_encoding == SampleEncoding::Delta) {
+            return fmt::format("Unsupported audio encoding \"{}\".", audio_encoding);
+        }
+        if (!parsed_viz_encoding) {
+            return fmt::format("Unknown viz encoding \"{}\".", viz_encoding);
+        }
+        config.audio_encoding = *parsed_audio_encoding;
+        config.viz_encoding = *parsed_viz_encoding;
+    } catch (const nlohmann::json::exception& e) {
+        return e.what();
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string> parse_sim_state(const nlohmann::json& json, SimState& state) {
+    try {
+        state = {
+            .x = json.at("x"),
+            .v = json.at("v"),
+        };
+    } catch (const nlohmann::json::exception& e) {
+        return e.what();
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string> parse_modal_params(const nlohmann::json& json, ModalParams& modes) {
+    try {
+        modes = {
+            .freq = json.at("freq"),
+            .decay = json.at("decay"),
+            .amp = json.at("amp"),
+            .phase = json.value("phase", std::vector<double>{}),
+        };
+    } catch (const nlohmann::json::exception& e) {
+        return e.what();
+    }
+
+    size_t mode_count = modes.freq.size();
+    if (modes.decay.size() != mode_count || modes.amp.size() != mode_count ||
+        (!modes.phase.empty() && modes.phase.size() != mode_count)) {
+        return "freq, decay, amp and phase must have one entry per mode.";
+    }
+    // An undamped mode would ring, and keep its session streaming, forever
+    for (double decay : modes.decay) {
+        if (!(decay > 0.0)) {
+            return "decay must be positive for every mode.";
+        }
+    }
+    if (mode_count > MAX_MODES) {
+        return fmt::format("At most {} modes are supported.", MAX_MODES);
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+
+#include "modal_sim.h"
+#include "session_registry.h"
+#include "sim.h"
+
+// Most modes a modal source accepts, far more than a mesh's audible modes
+static constexpr size_t MAX_MODES = 4096;
+
+// Each of these reads what the HTTP API (and the render command's jobs) take as JSON, and returns why
+// it is invalid if it is
+
+// A client config as PUT /api/sim/config/:id takes it
+std::optional<std::string> parse_client_config(const nlohmann::json& json, ClientConfig& config);
+// {"x": ..., "v": ...} as POST /api/sim/bonk/:id takes it
+std::optional<std::string> parse_sim_state(const nlohmann::json& json, SimState& state);
+// {"freq": [...], "decay": [...], "amp": [...], "phase": [...]} as POST /api/sim/modal/:id takes it
+std::optional<std::string> parse_modal_params(const nlohmann::json& json, ModalParams& modes);
@@ -0,0 +1,195 @@
+#include "decimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+// Stopband attenuation of every stage, in dB
+static constexpr double attenuation = 80.0;
+// Largest integer factor handled by a single stage
+static constexpr int max_stage_factor = 16;
+// Filter phases of the fractional stage
+static constexpr int fractional_phases = 128;
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; term > 1e-12 * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Prime factors of n grouped greedily, largest first, into stage factors of at most max_stage_factor
+static std::vector<int> split_factor(int n) {
+    std::vector<int> primes;
+    for (int p = 2; p * p <= n; p++) {
+        while (n % p == 0) {
+            primes.push_back(p);
+            n /= p;
+        }
+    }
+    if (n > 1) {
+        primes.push_back(n);
+    }
+    std::sort(primes.rbegin(), primes.rend());
+
+    std::vector<int> factors;
+    for (int p : primes) {
+        if (!factors.empty() && factors.back() * p <= max_stage_factor) {
+            factors.back() *= p;
+        } else {
+            factors.push_back(p);
+        }
+    }
+    return factors;
+}
+
+// Largest 2^a 3^b 5^c that is at most n
+static int smooth_floor(double n) {
+    int best = 1;
+    for (long long p2 = 1; p2 <= n; p2 *= 2) {
+        for (long long p3 = p2; p3 <= n; p3 *= 3) {
+            for (long long p5 = p3; p5 <= n; p5 *= 5) {
+                best = std::max(best, static_cast<int>(p5));
+            }
+        }
+    }
+    return best;
+}
+
+void Decimator::setup(int source_rate, int target_rate) {
+    this->stages.clear();
+    double ratio = static_cast<double>(source_rate) / target_rate;
+    if (ratio <= 1.0) {
+        // Nothing to remove, pass samples through
+        return;
+    }
+
+    // Everything below 40% of the target rate is kept, and nothing that would alias into it survives
+    double pass_edge = 0.4 * target_rate;
+
+    int integer_factor = static_cast<int>(std::round(ratio));
+    std::vector<int> factors = split_factor(integer_factor);
+    bool fractional = std::abs(ratio - integer_factor) > 1e-9 * ratio ||
+                      std::any_of(factors.begin(), factors.end(), [](int f) { return f > max_stage_factor; });
+    if (fractional) {
+        // The integer stages take the largest smooth factor of at most half the ratio, so the fractional
+        // stage is left a ratio in [2, 4), usually close to 2, which keeps its filter short. Below a ratio
+        // of 4 there are no integer stages and the fractional stage does all of it.
+        integer_factor = smooth_floor(ratio / 2);
+        factors = integer_factor > 1 ? split_factor(integer_factor) : std::vector<int>{};
+    }
+
+    double rate = source_rate;
+    for (size_t i = 0; i < factors.size(); i++) {
+        double output_rate = rate / factors[i];
+        bool is_last = !fractional && i + 1 == factors.size();
+        // Intermediate stages only need to stop what would fold back into the final passband
+        double stop_edge = is_last ? target_rate / 2.0 : output_rate - pass_edge;
+        this->stages.emplace_back(factors[i], pass_edge / rate, stop_edge / rate, 1);
+        rate = output_rate;
+    }
+
+    if (fractional) {
+        this->stages.emplace_back(rate / target_rate, pass_edge / rate, target_rate / 2.0 / rate, fractional_phases);
+    }
+}
+
+std::optional<float> Decimator::filter(float sample) {
+    for (Stage& stage : this->stages) {
+        if (!stage.push(sample, sample)) {
+            return std::nullopt;
+        }
+    }
+    return sample;
+}
+
+void Decimator::process(std::span<const float> input, std::vector<float>& output) {
+    if (this->stages.empty()) {
+        output.insert(output.end(), input.begin(), input.end());
+        return;
+    }
+
+    // Run each stage over the whole block, ping-ponging between the scratch buffers
+    std::span<const float> stage_input = input;
+    for (size_t i = 0; i + 1 < this->stages.size(); i++) {
+        std::vector<float>& stage_output = this->scratch[i % 2];
+        stage_output.clear();
+        this->stages[i].process(stage_input, stage_output);
+        stage_input = stage_output;
+    }
+    this->stages.back().process(stage_input, output);
+}
+
+Decimator::Stage::Stage(double step, double pass_edge, double stop_edge, int phases) {
+    this->step = step;
+    this->phases = phases;
+
+    // Kaiser's estimate of the length needed for the requested attenuation and transition width
+    double transition = stop_edge - pass_edge;
+    this->taps_per_phase = static_cast<int>(std::ceil((attenuation - 7.95) / (14.36 * transition))) + 1;
+    this->history.assign(2 * this->taps_per_phase, 0.0f);
+
+    // Windowed-sinc prototype sampled at phases points per input sample, then split into phases
+    double cutoff = (pass_edge + stop_edge) / 2;
+    double beta = 0.1102 * (attenuation - 8.7);
+    int length = this->taps_per_phase * phases;
+    double center = (length - 1) / 2.0;
+    std::vector<double> prototype(length);
+    for (int i = 0; i < length; i++) {
+        double t = (i - center) / phases;
+        double sinc = t == 0.0 ? 1.0 : std::sin(2 * std::numbers::pi * cutoff * t) / (2 * std::numbers::pi * cutoff * t);
+        double r = length > 1 ? 2.0 * i / (length - 1) - 1.0 : 0.0;
+        double window = bessel_i0(beta * std::sqrt(std::max(0.0, 1 - r * r))) / bessel_i0(beta);
+        prototype[i] = sinc * window;
+    }
+
+    // Tap j of phase q weights the sample j steps before the newest one; rows are stored oldest first
+    // and normalized to unit DC gain so every phase has the same passband level
+    this->coefficients.resize(length);
+    for (int q = 0; q < phases; q++) {
+        double sum = 0.0;
+        for (int j = 0; j < this->taps_per_phase; j++) {
+            sum += prototype[j * phases + q];
+        }
+        for (int j = 0; j < this->taps_per_phase; j++) {
+            this->coefficients[q * this->taps_per_phase + (this->taps_per_phase - 1 - j)] = prototype[j * phases + q] / sum;
+        }
+    }
+}
+
+bool Decimator::Stage::push(float sample, float& output) {
+    this->history[this->history_pos] = sample;
+    this->history[this->history_pos + this->taps_per_phase] = sample;
+    this->history_pos = this->history_pos + 1 == this->taps_per_phase ? 0 : this->history_pos + 1;
+
+    this->until_output -= 1.0;
+    if (this->until_output >= 0.0) {
+        return false;
+    }
+    // The output falls between the newest sample and the next one
+    double fraction = this->until_output + 1.0;
+    this->until_output += this->step;
+
+    int phase = std::min(static_cast<int>(fraction * this->phases), this->phases - 1);
+    const float* taps = &this->coefficients[phase * this->taps_per_phase];
+    const float* window = &this->history[this->history_pos];
+    float sum = 0.0f;
+    for (int j = 0; j < this->taps_per_phase; j++) {
+        sum += taps[j] * window[j];
+    }
+    output = sum;
+    return true;
+}
+
+void Decimator::Stage::process(std::span<const float> input, std::vector<float>& output) {
+    float sample;
+    for (float x : input) {
+        if (this->push(x, sample)) {
+            output.push_back(sample);
+        }
+    }
+}
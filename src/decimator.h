@@ -0,0 +1,43 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <vector>
+
+// Anti-aliased downsampler. The rate change is split into a cascade of integer FIR stages, plus a
+// polyphase fractional stage when the ratio is not a (smooth) integer, and each stage only evaluates
+// its filter for the samples it keeps.
+class Decimator {
+  public:
+    void setup(int source_rate, int target_rate);
+    std::optional<float> filter(float sample);
+    // Filters every sample of input, appending the decimated samples to output
+    void process(std::span<const float> input, std::vector<float>& output);
+
+  private:
+    class Stage {
+      public:
+        // Edges are in cycles per input sample. phases > 1 makes a fractional stage.
+        Stage(double step, double pass_edge, double stop_edge, int phases);
+        // Returns true and sets output when this sample completes an output sample
+        bool push(float sample, float& output);
+        void process(std::span<const float> input, std::vector<float>& output);
+
+      private:
+        // Input samples per output sample
+        double step;
+        // Time of the next output, in input samples after the newest one
+        double until_output{0.0};
+        int phases;
+        int taps_per_phase;
+        // One row of taps_per_phase coefficients per phase, ordered oldest to newest sample
+        std::vector<float> coefficients;
+        // Last taps_per_phase inputs, written twice so the filter window is always contiguous
+        std::vector<float> history;
+        size_t history_pos{0};
+    };
+
+    std::vector<Stage> stages;
+    // Intermediate outputs between stages for process()
+    std::vector<float> scratch[2];
+};
@@ -1,61 +1,408 @@
 #include "event_stream.h"
 
-#include <base64.hpp>
-#include <fmt/core.h>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+#include <iterator>
 #include <spdlog/spdlog.h>
 
+#include "metrics.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BONK_X86 1
+#endif
+
+// Appends the standard base64 encoding of size bytes at data to out
+static void append_base64(std::string& out, const void* data, size_t size) {
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    size_t start = out.size();
+    out.resize(start + (size + 2) / 3 * 4);
+    char* dst = &out[start];
+
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        uint32_t triple = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+        *dst++ = alphabet[(triple >> 18) & 0x3f];
+        *dst++ = alphabet[(triple >> 12) & 0x3f];
+        *dst++ = alphabet[(triple >> 6) & 0x3f];
+        *dst++ = alphabet[triple & 0x3f];
+    }
+    if (i < size) {
+        uint32_t triple = bytes[i] << 16;
+        if (i + 1 < size) {
+            triple |= bytes[i + 1] << 8;
+        }
+        *dst++ = alphabet[(triple >> 18) & 0x3f];
+        *dst++ = alphabet[(triple >> 12) & 0x3f];
+        *dst++ = i + 1 < size ? alphabet[(triple >> 6) & 0x3f] : '=';
+        *dst++ = '=';
+    }
+}
+
+std::optional<SampleEncoding> parse_sample_encoding(const std::string& name) {
+    if (name == "f32") {
+        return SampleEncoding::F32;
+    } else if (name == "s16") {
+        return SampleEncoding::S16;
+    } else if (name == "f16") {
+        return SampleEncoding::F16;
+    } else if (name == "delta") {
+        return SampleEncoding::Delta;
+    }
+    return std::nullopt;
+}
+
+// Grows out by size bytes and returns where they start
+static char* extend(std::string& out, size_t size) {
+    size_t start = out.size();
+    out.resize(start + size);
+    return &out[start];
+}
+
+static float max_abs(std::span<const float> samples) {
+    size_t i = 0;
+    float result = 0.0f;
+#if defined(__SSE2__)
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 max4 = _mm_setzero_ps();
+    for (; i + 4 <= samples.size(); i += 4) {
+        max4 = _mm_max_ps(max4, _mm_and_ps(_mm_loadu_ps(&samples[i]), abs_mask));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, max4);
+    result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+    for (; i < samples.size(); i++) {
+        result = std::max(result, std::abs(samples[i]));
+    }
+    return result;
+}
+
+static void append_s16(std::span<const float> samples, std::string& out) {
+    // Scale the loudest sample of the block to full range, since sim output isn't normalized
+    float peak = max_abs(samples);
+    float scale = peak > 0.0f ? peak / 32767.0f : 0.0f;
+    float inverse = peak > 0.0f ? 32767.0f / peak : 0.0f;
+
+    char* dst = extend(out, sizeof(float) + samples.size() * sizeof(int16_t));
+    std::memcpy(dst, &scale, sizeof(float));
+    dst += sizeof(float);
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 inverse4 = _mm_set1_ps(inverse);
+    for (; i + 8 <= samples.size(); i += 8) {
+        // Rounds to nearest, and the pack saturates
+        __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&samples[i]), inverse4));
+        __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&samples[i + 4]), inverse4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * sizeof(int16_t)), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < samples.size(); i++) {
+        auto value = static_cast<int16_t>(std::clamp(std::nearbyint(samples[i] * inverse), -32768.0f, 32767.0f));
+        std::memcpy(dst + i * sizeof(int16_t), &value, sizeof(int16_t));
+    }
+}
+
+// Round to nearest even, like the hardware conversion
+static uint16_t float_to_half(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude >= 0x7f800000) {
+        // Infinity, or NaN kept quiet
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+    if (magnitude >= 0x477ff000) {
+        // Rounds past the largest half
+        return sign | 0x7c00;
+    }
+    if (magnitude < 0x38800000) {
+        // Below the smallest normal half, so shift the mantissa into a subnormal
+        if (magnitude < 0x33000000) {
+            return sign;
+        }
+        uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - (magnitude >> 23);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1))) {
+            half++;
+        }
+        return sign | half;
+    }
+
+    // Rebias the exponent and drop 13 mantissa bits, a carry correctly bumps the exponent
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return sign | half;
+}
+
+#if defined(BONK_X86)
+__attribute__((target("avx,f16c"))) static size_t to_half_f16c(const float* samples, size_t n, char* dst) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(samples + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * sizeof(uint16_t)), halves);
+    }
+    return i;
+}
+#endif
+
+static void append_f16(std::span<const float> samples, std::string& out) {
+    char* dst = extend(out, samples.size() * sizeof(uint16_t));
+
+    size_t i = 0;
+#if defined(BONK_X86)
+    static const bool has_f16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    if (has_f16c) {
+        i = to_half_f16c(samples.data(), samples.size(), dst);
+    }
+#endif
+    for (; i < samples.size(); i++) {
+        uint16_t half = float_to_half(samples[i]);
+        std::memcpy(dst + i * sizeof(uint16_t), &half, sizeof(uint16_t));
+    }
+}
+
+static void append_varint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static uint32_t zigzag_delta(uint32_t bits, uint32_t previous) {
+    auto delta = static_cast<int32_t>(bits - previous);
+    return (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+}
+
+static void append_delta(std::span<const float> samples, std::string& out) {
+    // At most 5 bytes per varint, so reserving up front keeps push_back from reallocating
+    out.reserve(out.size() + 5 * samples.size());
+
+    uint32_t previous = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= samples.size(); i += 4) {
+        __m128i bits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&samples[i]));
+        // Each lane minus the lane before it, with the last sample of the previous group in front
+        __m128i before = _mm_or_si128(_mm_slli_si128(bits, 4), _mm_cvtsi32_si128(static_cast<int>(previous)));
+        __m128i delta = _mm_sub_epi32(bits, before);
+        __m128i zigzag = _mm_xor_si128(_mm_slli_epi32(delta, 1), _mm_srai_epi32(delta, 31));
+
+        uint32_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), zigzag);
+        for (uint32_t lane : lanes) {
+            append_varint(out, lane);
+        }
+        previous = std::bit_cast<uint32_t>(samples[i + 3]);
+    }
+#endif
+    for (; i < samples.size(); i++) {
+        uint32_t bits = std::bit_cast<uint32_t>(samples[i]);
+        append_varint(out, zigzag_delta(bits, previous));
+        previous = bits;
+    }
+}
+
+void encode_samples(std::span<const float> samples, SampleEncoding encoding, std::string& out) {
+    switch (encoding) {
+        case SampleEncoding::F32:
+            // Fine as long as server is known little-endian and client parses that way too
+            out.append(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(float));
+            break;
+        case SampleEncoding::S16:
+            append_s16(samples, out);
+            break;
+        case SampleEncoding::F16:
+            append_f16(samples, out);
+            break;
+        case SampleEncoding::Delta:
+            append_delta(samples, out);
+            break;
+    }
+}
+
 Event Event::from_heartbeat() {
     return {
-        .event_type = "heartbeat",
+        .type = EventType::Heartbeat,
     };
 }
 
-Event Event::from_audio_block(std::vector<float> audio_block, size_t sample_idx) {
-    // Fine as long as server is known little-endian and client parses that way too
-    const char* ptr = reinterpret_cast<const char*>(audio_block.data());
-    std::string buffer = base64::encode_into<std::string>(&ptr[0], &ptr[audio_block.size() * sizeof(float)]);
-    return {
-        .id = fmt::format("{}", sample_idx),
-        .event_type = "audio-block",
-        .data = buffer,
-    };
+void Event::assign(EventType type, std::span<const float> samples, size_t sample_idx, SampleEncoding encoding) {
+    this->type = type;
+    this->sample_idx = sample_idx;
+    this->samples.assign(samples.begin(), samples.end());
+    this->encoding = encoding;
+    this->queued_at = std::chrono::steady_clock::now();
 }
 
-Event Event::from_viz_block(std::vector<float> viz_block, size_t sample_idx) {
-    // TODO this will be replaced with mesh vertex data
-    // Fine as long as server is known little-endian and client parses that way too
-    const char* ptr = reinterpret_cast<const char*>(viz_block.data());
-    std::string buffer = base64::encode_into<std::string>(&ptr[0], &ptr[viz_block.size() * sizeof(float)]);
-    return {
-        .id = fmt::format("{}", sample_idx),
-        .event_type = "viz-block",
-        .data = buffer,
+void Event::write_sse(std::string& out) const {
+    // See https://developer.mozilla.org/en-US/docs/Web/API/Server-sent_events/Using_server-sent_events#event_stream_format
+    out.clear();
+    if (this->type == EventType::Heartbeat) {
+        out.append("id: \nevent: heartbeat\ndata: \n\n");
+        return;
+    }
+
+    const char* event_type = this->type == EventType::AudioBlock ? "audio-block" : "viz-block";
+    fmt::format_to(std::back_inserter(out), "id: {}\nevent: {}\ndata: ", this->sample_idx, event_type);
+    // Pack first, base64 works on the packed bytes. Each connection writes from a single thread, so
+    // the scratch buffer is reused across its events.
+    thread_local std::string payload;
+    payload.clear();
+    encode_samples(this->samples, this->encoding, payload);
+    append_base64(out, payload.data(), payload.size());
+    out.append("\n\n");
+}
+
+void Event::write_binary(std::string& out) const {
+    // Fine as long as server is known little-endian, like the payload
+    BinaryFrameHeader header = {
+        .type = static_cast<uint8_t>(this->type),
+        .format = static_cast<uint8_t>(this->encoding),
+        .reserved = 0,
+        .length = 0,
+        .sample_idx = this->sample_idx,
     };
+    out.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    encode_samples(this->samples, this->encoding, out);
+
+    // Length is only known once the payload is packed
+    header.length = static_cast<uint32_t>(out.size() - sizeof(header));
+    std::memcpy(out.data(), &header, sizeof(header));
 }
 
-std::string Event::to_string() const {
-    // See https://developer.mozilla.org/en-US/docs/Web/API/Server-sent_events/Using_server-sent_events#event_stream_format
-    return fmt::format("id: {}\nevent: {}\ndata: {}\n\n", this->id.value_or(""), this->event_type, this->data);
+EventStream::EventStream(size_t audio_capacity, size_t viz_capacity)
+    : audio_events(audio_capacity)
+    , viz_events(viz_capacity) {}
+
+void EventStream::send(EventType type, std::span<const float> samples, size_t sample_idx, SampleEncoding encoding,
+                       const std::atomic<bool>* cancelled) {
+    if (type == EventType::VizBlock) {
+        if (this->has_held_viz) {
+            if (Event* slot = this->viz_events.acquire()) {
+                // Swapping hands the slot's old buffer to held_viz for reuse
+                std::swap(*slot, this->held_viz);
+                this->viz_events.publish();
+                this->has_held_viz = false;
+            }
+        }
+
+        Event* slot = this->has_held_viz ? nullptr : this->viz_events.acquire();
+        if (slot) {
+            slot->assign(type, samples, sample_idx, encoding);
+            this->viz_events.publish();
+        } else {
+            // Full, so keep only the newest block and have the consumer catch up
+            if (this->has_held_viz) {
+                this->dropped_viz++;
+                increment_counter(MetricCounter::DroppedVizBlocks);
+            }
+            this->held_viz.assign(type, samples, sample_idx, encoding);
+            this->has_held_viz = true;
+            this->viz_overflowed = true;
+        }
+    } else {
+        while (true) {
+            // Read before checking why to give up, so a wake after the check still ends the wait below
+            uint32_t seen = this->consumed.load();
+            if (this->closed || (cancelled != nullptr && cancelled->load())) {
+                break;
+            }
+            if (Event* slot = this->audio_events.acquire()) {
+                slot->assign(type, samples, sample_idx, encoding);
+                this->audio_events.publish();
+                break;
+            }
+            this->consumed.wait(seen);
+        }
+    }
+
+    this->sent.fetch_add(1);
+    this->sent.notify_one();
+}
+
+void EventStream::send_heartbeat() {
+    // Heartbeats come from their own thread, so they can't go through the single-producer rings
+    this->heartbeat_pending = true;
+    this->sent.fetch_add(1);
+    this->sent.notify_one();
+}
+
+void EventStream::wake_producer() {
+    this->consumed.fetch_add(1);
+    this->consumed.notify_all();
+}
+
+void EventStream::close() {
+    this->closed = true;
+    this->wake_producer();
+    this->sent.fetch_add(1);
+    this->sent.notify_all();
+}
+
+size_t EventStream::pending() const {
+    return this->audio_events.size() + this->viz_events.size();
 }
 
-void EventStream::send(const Event& event) {
-    std::unique_lock<std::mutex> lk(mutex);
-    message_queue.push(event);
-    cv.notify_all();
+size_t EventStream::capacity() const {
+    return this->audio_events.capacity();
 }
 
-void EventStream::on_event(std::function<bool(const Event&)> callback) {
-    std::unique_lock<std::mutex> lk(mutex);
-    while (this->message_queue.empty()) {
-        cv.wait(lk);
+size_t EventStream::dropped() const {
+    return this->dropped_viz.load();
+}
+
+bool EventStream::on_event(const std::function<bool(const Event&)>& callback) {
+    uint32_t seen = this->sent.load();
+    while (!this->heartbeat_pending && this->audio_events.size() == 0 && this->viz_events.size() == 0) {
+        if (this->closed) {
+            return false;
+        }
+        this->sent.wait(seen);
+        seen = this->sent.load();
     }
 
-    while (!this->message_queue.empty()) {
-        const Event& e = this->message_queue.front();
-        if (!callback(e)) {
+    static const Event heartbeat = Event::from_heartbeat();
+    if (this->heartbeat_pending.exchange(false) && !callback(heartbeat)) {
+        return !this->closed;
+    }
+
+    while (Event* e = this->audio_events.front()) {
+        if (!callback(*e)) {
             // Stop writing if a write failed
-            return;
+            return !this->closed;
         }
-        this->message_queue.pop();
+        this->audio_events.pop();
+        this->consumed.fetch_add(1);
+        this->consumed.notify_one();
     }
-}
\ No newline at end of file
+
+    if (this->viz_overflowed.exchange(false)) {
+        // Stale positions are useless, only the newest one is worth sending
+        while (this->viz_events.size() > 1) {
+            this->viz_events.pop();
+            this->dropped_viz++;
+            increment_counter(MetricCounter::DroppedVizBlocks);
+        }
+    }
+    while (Event* e = this->viz_events.front()) {
+        if (!callback(*e)) {
+            return !this->closed;
+        }
+        this->viz_events.pop();
+    }
+    return !this->closed;
+}
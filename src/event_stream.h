@@ -1,30 +1,112 @@
 #pragma once
 
-#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
-#include <queue>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "spsc_ring.h"
+
+enum class EventType : uint8_t {
+    Heartbeat = 0,
+    AudioBlock = 1,
+    VizBlock = 2,
+};
+
+// How the samples of a block are packed into its payload, negotiated per client. All little-endian.
+enum class SampleEncoding : uint8_t {
+    // 32-bit floats
+    F32 = 0,
+    // A 32-bit float scale followed by 16-bit signed ints, each sample is the int times the scale
+    S16 = 1,
+    // IEEE half-precision floats
+    F16 = 2,
+    // Lossless. Each sample's float bits minus the previous sample's (zero before the first),
+    // zigzagged and written as a LEB128 varint. Meant for slowly changing viz blocks.
+    Delta = 3,
+};
+
+// "f32", "s16", "f16" or "delta"
+std::optional<SampleEncoding> parse_sample_encoding(const std::string& name);
+// Appends samples to out, packed as encoding
+void encode_samples(std::span<const float> samples, SampleEncoding encoding, std::string& out);
+
+// Every frame on the binary stream is this header followed by length bytes of payload. All fields are
+// little-endian, and the payload of audio and viz blocks is packed as given by format.
+struct BinaryFrameHeader {
+    uint8_t type;   // EventType
+    uint8_t format; // SampleEncoding
+    uint16_t reserved;
+    uint32_t length;
+    uint64_t sample_idx;
+};
+static_assert(sizeof(BinaryFrameHeader) == 16);
+
+// Events keep raw samples, and are only encoded by the transport that writes them out. They are
+// filled in place and reused, so in steady state streaming a block never allocates.
 struct Event {
-    std::optional<std::string> id;
-    std::string event_type;
-    std::string data;
+    EventType type;
+    size_t sample_idx;
+    std::vector<float> samples;
+    SampleEncoding encoding{SampleEncoding::F32};
+    // When the producer assigned it, for timing how long it waits to be written
+    std::chrono::steady_clock::time_point queued_at{};
 
-    static Event from_audio_block(std::vector<float> audio_block, size_t sample_idx);
-    static Event from_viz_block(std::vector<float> viz_block, size_t sample_idx);
+    // Reuses the capacity of samples
+    void assign(EventType type, std::span<const float> samples, size_t sample_idx, SampleEncoding encoding);
     static Event from_heartbeat();
 
-    std::string to_string() const;
+    // Encoders overwrite out, reusing its capacity
+    void write_sse(std::string& out) const;
+    void write_binary(std::string& out) const;
 };
 
+// Events flow from a single producer (whichever thread is stepping the client's sim) to a single
+// consumer (the client's connection) through lock-free rings. Heartbeats may come from any thread.
+// When the viz ring overflows, the oldest viz blocks are dropped; audio blocks are never dropped.
 class EventStream {
   public:
-    void on_event(std::function<bool(const Event&)> callback);
-    void send(const Event& event);
+    EventStream(size_t audio_capacity = 256, size_t viz_capacity = 64);
+
+    // Consumer side. Blocks until there is something to write, then writes it all. Returns false once
+    // the stream is closed.
+    bool on_event(const std::function<bool(const Event&)>& callback);
+    // Producer side. Copies samples into a preallocated event, waiting for the consumer if the audio
+    // ring is full. The samples are packed as encoding when they are written out. An audio block that
+    // doesn't fit is dropped instead once the stream is closed, or once cancelled is set and the producer
+    // is woken with wake_producer().
+    void send(EventType type, std::span<const float> samples, size_t sample_idx,
+              SampleEncoding encoding = SampleEncoding::F32, const std::atomic<bool>* cancelled = nullptr);
+    // Safe from any thread
+    void send_heartbeat();
+    // Wakes a producer waiting for space so it checks whether it was cancelled
+    void wake_producer();
+    // Wakes and releases a producer that is waiting on a consumer that is gone, and a consumer that is
+    // waiting on a producer
+    void close();
+    // Number of events waiting to be written to the client
+    size_t pending() const;
+    size_t capacity() const;
+    size_t dropped() const;
 
   private:
-    std::queue<Event> message_queue;
-    std::condition_variable cv;
-    std::mutex mutex;
-};
\ No newline at end of file
+    SpscRing<Event> audio_events;
+    SpscRing<Event> viz_events;
+    // Producer only. Newest viz block that did not fit, retried on the next send.
+    Event held_viz;
+    bool has_held_viz{false};
+    // Tells the consumer to skip to the newest queued viz block
+    std::atomic<bool> viz_overflowed{false};
+    std::atomic<bool> heartbeat_pending{false};
+    std::atomic<bool> closed{false};
+    std::atomic<size_t> dropped_viz{0};
+
+    // Bumped on every send so the consumer can wait for new events
+    std::atomic<uint32_t> sent{0};
+    // Bumped every time the consumer frees audio slots, so the producer can wait for space
+    std::atomic<uint32_t> consumed{0};
+};
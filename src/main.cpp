@@ -1,167 +1,317 @@
+#include <algorithm>
 #include <chrono>
 #include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <fmt/core.h>
 #include <httplib.h>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <optional>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <thread>
-#include <unordered_map>
-// #include <npy/npy.h>
-// #include <npy/tensor.h>
 
+#include "config.h"
 #include "event_stream.h"
+#include "metrics.h"
+#include "modal_sim.h"
+#include "render.h"
+#include "session_registry.h"
 #include "sim.h"
+#include "sim_scheduler.h"
+#include "source.h"
+#include "timer_service.h"
 
-int main() {
+// Keeps idle connections (and proxies in front of them) from timing out
+static constexpr auto HEARTBEAT_INTERVAL = std::chrono::seconds(5);
+// How often sessions are checked for finished sims and idleness
+static constexpr auto SWEEP_INTERVAL = std::chrono::seconds(30);
+
+int main(int argc, char** argv) {
 #ifdef ENABLE_DEBUG_LOGS
     spdlog::set_level(spdlog::level::debug);
 #endif
 
+    // One worker per core unless overridden
+    size_t sim_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (const char* env_threads = std::getenv("BONK_SIM_THREADS")) {
+        sim_threads = std::max(1, std::atoi(env_threads));
+    }
+
+    // `bonk render jobs.json` renders straight to files instead of serving, see render.h
+    if (argc > 1 && std::string(argv[1]) == "render") {
+        if (argc != 3) {
+            fmt::print(stderr, "usage: {} render <jobs.json>\n", argv[0]);
+            return 2;
+        }
+        return run_render(argv[2], sim_threads);
+    }
+
+    SimScheduler scheduler(sim_threads);
+
+    // Sessions that never connect a stream are dropped after this long without activity
+    std::chrono::seconds session_timeout(600);
+    if (const char* env_timeout = std::getenv("BONK_SESSION_TIMEOUT_S")) {
+        session_timeout = std::chrono::seconds(std::max(1, std::atoi(env_timeout)));
+    }
+
     httplib::Server server;
-    std::unordered_map<std::string, Sim> sims;
-    std::unordered_map<std::string, SimParams> configs;
-    std::unordered_map<std::string, std::shared_ptr<EventStream>> event_streams;
-
-    std::thread([&]() {
-        while (true) {
-            for (auto& [id, stream] : event_streams) {
-                spdlog::debug("id {} has refcount {}", id, stream.use_count());
+    SessionRegistry sessions;
+    // Declared after everything its callbacks use, so it is stopped before any of that is destroyed
+    TimerService timers;
+
+    timers.every(SWEEP_INTERVAL, [&]() {
+        // Removing takes the registry's locks, which for_each is holding
+        std::vector<std::shared_ptr<Session>> idle;
+        sessions.for_each([&](const std::shared_ptr<Session>& session) {
+            if (session->release_finished_sim()) {
+                spdlog::debug("released finished sim of session {}", session->get_id());
+            }
+            // A session with a stream ends with its connection instead
+            if (session->get_stream() == nullptr && session->idle_for() > session_timeout) {
+                idle.push_back(session);
             }
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+        });
+        for (const auto& session : idle) {
+            spdlog::info("removing session {} after {}s idle", session->get_id(),
+                         std::chrono::duration_cast<std::chrono::seconds>(session->idle_for()).count());
+            sessions.remove(session);
         }
-    }).detach();
+        return true;
+    });
 
-    server.Get("/api/sim/stream/:id", [&](const httplib::Request& req, httplib::Response& res) {
+    if (spdlog::should_log(spdlog::level::debug)) {
+        timers.every(std::chrono::seconds(1), [&]() {
+            sessions.for_each([](const std::shared_ptr<Session>& session) {
+                spdlog::debug("id {} has refcount {}", session->get_id(), session->get_stream().use_count());
+            });
+            spdlog::debug("scheduler queue depth is {} with {} parked", scheduler.queue_depth(), scheduler.parked_count());
+            for (const SimStats& sim_stats : scheduler.stats()) {
+                spdlog::debug("sim {} is {:.3f}s behind real time", sim_stats.id, sim_stats.lag);
+            }
+            return true;
+        });
+    }
+
+    // Both stream endpoints read the client's EventStream and differ only in how events are encoded. A new
+    // connection for the same client, to either endpoint, takes over the session and ends the old one.
+    auto serve_stream = [&](const httplib::Request& req, httplib::Response& res, const std::string& content_type,
+                            void (Event::*encode)(std::string&) const) {
         std::string client_id = req.path_params.at("id");
-        if (!event_streams.contains(client_id))
-            event_streams.insert({client_id, std::make_shared<EventStream>()});
-        auto event_stream = event_streams.at(client_id);
-        spdlog::info("GET /api/sim/stream/{} -> (streaming)", client_id);
-
-        std::thread([event_stream]() {
-            while (true) {
-                event_stream->send(Event::from_heartbeat());
-                std::this_thread::sleep_for(std::chrono::seconds(5));
+        auto session = sessions.get_or_create(client_id);
+        auto event_stream = session->open_stream();
+        spdlog::info("GET {} -> (streaming)", req.path);
+
+        uint64_t heartbeat = timers.every(HEARTBEAT_INTERVAL, [event_stream]() {
+            event_stream->send_heartbeat();
+            return true;
+        });
+
+        // Reused for every event on this connection, so steady-state writes don't allocate
+        struct Connection {
+            httplib::DataSink* sink;
+            std::string buffer;
+        };
+        auto connection = std::make_shared<Connection>();
+        std::function<bool(const Event&)> write_event = [conn = connection.get(), encode](const Event& event) {
+            if (conn->sink->is_writable()) {
+                auto encode_start = std::chrono::steady_clock::now();
+                if (event.type != EventType::Heartbeat) {
+                    observe_stage(Stage::QueueWait, encode_start - event.queued_at);
+                }
+                (event.*encode)(conn->buffer);
+                auto write_start = std::chrono::steady_clock::now();
+                observe_stage(Stage::Encode, write_start - encode_start);
+                conn->sink->write(conn->buffer.data(), conn->buffer.size());
+                observe_stage(Stage::SocketWrite, std::chrono::steady_clock::now() - write_start);
+                increment_counter(MetricCounter::EventsWritten);
+                increment_counter(MetricCounter::BytesWritten, conn->buffer.size());
+                return true;
+            } else {
+                conn->sink->done();
+                return false;
             }
-        }).detach();
+        };
 
         res.set_header("Transfer-Encoding", "chunked");
         res.set_header("Cache-Control", "no-cache");
         res.set_header("Connection", "keep-alive");
         res.set_chunked_content_provider(
-            "text/event-stream",
-            [event_stream](size_t, httplib::DataSink& sink) {
-                event_stream->on_event([&sink](const Event& event) {
-                    if (sink.is_writable()) {
-                        const std::string& message = event.to_string();
-                        sink.write(message.data(), message.size());
-                        return true;
-                    } else {
-                        sink.done();
-                        return false;
-                    }
-                });
-                // False means the connection should be cancelled
-                return true;
+            content_type,
+            [event_stream, connection, write_event](size_t, httplib::DataSink& sink) {
+                connection->sink = &sink;
+                // False means the connection should be cancelled, as it is once a newer one replaced it
+                return event_stream->on_event(write_event);
             },
-            [client_id, &sims, &configs, &event_streams](bool success) {
-                // Invariant: each client maintains a consistent connection to this endpoint
-                sims.erase(client_id);
-                configs.erase(client_id);
-                // If stream_managers owned the StreamManager objects, this would be UB since
-                // it would free a (likely) locked mutex. Instead, just decrement reference count
-                event_streams.erase(client_id);
+            [session, event_stream, heartbeat, &sessions, &timers](bool success) {
+                timers.cancel(heartbeat);
+                // The session ends with its newest connection, otherwise a paced sim would wait forever for
+                // this stream to drain. One that was replaced already had its stream closed by the new one.
+                // The sim may still hold the stream, so it lives on until the sim is done with it.
+                if (session->get_stream() == event_stream) {
+                    sessions.remove(session);
+                }
             });
+    };
+
+    server.Get("/api/sim/stream/:id", [&](const httplib::Request& req, httplib::Response& res) {
+        serve_stream(req, res, "text/event-stream", &Event::write_sse);
+    });
+
+    // Same events as /api/sim/stream/:id without base64 or text framing, see BinaryFrameHeader
+    server.Get("/api/sim/binary/:id", [&](const httplib::Request& req, httplib::Response& res) {
+        serve_stream(req, res, "application/octet-stream", &Event::write_binary);
     });
 
     server.Put("/api/sim/config/:id", [&](const httplib::Request& req, httplib::Response& res) {
-        SimParams params;
-        try {
-            auto json_body = nlohmann::json::parse(req.body);
-            params = {
-                .physics_sample_rate = json_body["physicsSampleRate"],
-                .physics_block_size = json_body["physicsBlockSize"],
-                .audio_sample_rate = json_body["audioSampleRate"],
-                .audio_block_size = json_body["audioBlockSize"],
-                .viz_sample_rate = json_body["vizSampleRate"],
-                .viz_block_size = json_body["vizBlockSize"],
-                .mass = json_body["mass"],
-                .stiffness = json_body["stiffness"],
-                .damping = json_body["damping"],
-                .area = json_body["area"],
-            };
-        } catch (nlohmann::json::exception e) {
+        ClientConfig config;
+        auto json_body = nlohmann::json::parse(req.body, nullptr, false);
+        std::optional<std::string> error =
+            json_body.is_discarded() ? "Body is not valid JSON." : parse_client_config(json_body, config);
+        if (error) {
             res.status = 400;
-            res.body = e.what();
+            res.body = *error;
             return;
         }
 
         std::string client_id = req.path_params.at("id");
-        configs[client_id] = std::move(params);
+        sessions.get_or_create(client_id)->set_config(std::move(config));
     });
 
+    // Plays the source built by make_source from the client's config on its stream, in place of whatever
+    // was playing before. Fails with 412 if the client has not set a config.
+    auto start_source = [&](const std::string& client_id, httplib::Response& res,
+                            const std::function<std::shared_ptr<Source>(const ClientConfig&)>& make_source) {
+        auto session = sessions.find(client_id);
+        std::optional<ClientConfig> config = session != nullptr ? session->get_config() : std::nullopt;
+        if (!config) {
+            res.status = 412; // Precondition failed
+            res.body = "Must set a config before starting sim.";
+            return;
+        }
+
+        std::shared_ptr<Source> sim = make_source(*config);
+        std::shared_ptr<EventStream> event_stream = session->get_stream();
+        sim->set_audio_callback([event_stream, audio_sample_idx = size_t{0}, encoding = config->audio_encoding,
+                                 &params = sim->get_params(), &stopped = sim->stop_requested()](auto& audio_block) mutable {
+            if (event_stream != nullptr) {
+                // A stopped sim's blocks are never played, so it shouldn't wait for room for them
+                event_stream->send(EventType::AudioBlock, audio_block, audio_sample_idx, encoding, &stopped);
+            }
+
+            audio_sample_idx += params.audio_block_size;
+        });
+
+        sim->set_viz_callback([event_stream, viz_sample_idx = size_t{0}, encoding = config->viz_encoding,
+                               &params = sim->get_params()](auto& viz_block) mutable {
+            if (event_stream != nullptr) {
+                event_stream->send(EventType::VizBlock, viz_block, viz_sample_idx, encoding);
+            }
+
+            viz_sample_idx += params.viz_block_size;
+        });
+
+        sim->set_stop_callback([event_stream]() {
+            if (event_stream != nullptr) {
+                event_stream->wake_producer();
+            }
+        });
+
+        // Cancels a previously running simulation, which must be done stepping before this one starts
+        // producing into the same stream
+        session->replace_sim(sim);
+        scheduler.submit(client_id, sim, event_stream);
+
+        // "No data" makes sense here
+        res.status = 204;
+    };
+
     server.Post("/api/sim/bonk/:id", [&](const httplib::Request& req, httplib::Response& res) {
-        // TODO lock the client states
         SimState initial_state;
-        try {
-            auto json_body = nlohmann::json::parse(req.body);
-            initial_state = {
-                .x = json_body["x"],
-                .v = json_body["v"],
-            };
-        } catch (nlohmann::json::exception e) {
+        auto json_body = nlohmann::json::parse(req.body, nullptr, false);
+        std::optional<std::string> error =
+            json_body.is_discarded() ? "Body is not valid JSON." : parse_sim_state(json_body, initial_state);
+        if (error) {
             res.status = 400;
-            res.body = e.what();
+            res.body = *error;
             return;
         }
 
-        std::string client_id = req.path_params.at("id");
-        if (!configs.contains(client_id)) {
-            res.status = 412; // Precondition failed
-            res.body = "Must set a config before starting sim.";
+        start_source(req.path_params.at("id"), res, [&](const ClientConfig& config) {
+            return std::make_shared<Sim>(config.params, initial_state);
+        });
+    });
+
+    // Plays an excitation of a mesh's modes, e.g. the amplitudes and phases the bonk addon's /modes
+    // returns after a bonk, as {"freq": [...], "decay": [...], "amp": [...], "phase": [...]}
+    server.Post("/api/sim/modal/:id", [&](const httplib::Request& req, httplib::Response& res) {
+        ModalParams modes;
+        auto json_body = nlohmann::json::parse(req.body, nullptr, false);
+        std::optional<std::string> error =
+            json_body.is_discarded() ? "Body is not valid JSON." : parse_modal_params(json_body, modes);
+        if (error) {
+            res.status = 400;
+            res.body = *error;
             return;
         }
 
-        // Stop a previously running simulation
-        if (sims.contains(client_id)) {
-            sims.at(client_id).stop();
-        }
-        SimParams params = configs.at(client_id);
-        sims.insert_or_assign(client_id, Sim(params, initial_state));
-        Sim& sim = sims.at(client_id);
-
-        std::thread([client_id, params, &sim, &event_streams]() {
-            bool should_step = true;
-            size_t audio_sample_idx = 0;
-            size_t viz_sample_idx = 0;
-
-            std::shared_ptr<EventStream> event_stream = event_streams.contains(client_id) ? event_streams.at(client_id) : nullptr;
-            sim.set_audio_callback([event_stream, &audio_sample_idx, &params](auto& audio_block) {
-                if (event_stream != nullptr) {
-                    event_stream->send(Event::from_audio_block(audio_block, audio_sample_idx));
-                }
+        start_source(req.path_params.at("id"), res, [&](const ClientConfig& config) {
+            return std::make_shared<ModalSim>(config.params, modes);
+        });
+    });
 
-                audio_sample_idx += params.audio_block_size;
+    server.Get("/api/sim/scheduler", [&](const httplib::Request& req, httplib::Response& res) {
+        nlohmann::json sims_json = nlohmann::json::array();
+        for (const SimStats& sim_stats : scheduler.stats()) {
+            sims_json.push_back({
+                {"id", sim_stats.id},
+                {"simTime", sim_stats.sim_time},
+                {"lag", sim_stats.lag},
             });
+        }
 
-            sim.set_viz_callback([event_stream, &viz_sample_idx, &params](auto& viz_block) {
-                if (event_stream != nullptr) {
-                    event_stream->send(Event::from_viz_block(viz_block, viz_sample_idx));
-                }
-
-                viz_sample_idx += params.viz_block_size;
-            });
+        nlohmann::json body = {
+            {"threads", scheduler.thread_count()},
+            {"queueDepth", scheduler.queue_depth()},
+            {"parked", scheduler.parked_count()},
+            {"sims", sims_json},
+        };
+        res.set_content(body.dump(), "application/json");
+    });
 
-            double dt = 1. / params.physics_sample_rate;
-            while (should_step) {
-                should_step = sim.step(dt);
+    // Prometheus text format. Stage timings and counters are process-wide totals, the gauges are read
+    // from the scheduler and sessions on every scrape.
+    server.Get("/api/metrics", [&](const httplib::Request& req, httplib::Response& res) {
+        std::vector<SimStats> sim_stats = scheduler.stats();
+        std::vector<std::pair<std::string, double>> realtime_factors;
+        for (const SimStats& stats : sim_stats) {
+            double wall_time = stats.sim_time + stats.lag;
+            if (wall_time > 0) {
+                realtime_factors.emplace_back(stats.id, stats.sim_time / wall_time);
             }
-            spdlog::debug("finished stepping sim");
-        }).detach();
+        }
+        std::vector<std::pair<std::string, double>> pending_events;
+        sessions.for_each([&](const std::shared_ptr<Session>& session) {
+            if (auto stream = session->get_stream()) {
+                pending_events.emplace_back(session->get_id(), stream->pending());
+            }
+        });
 
-        // "No data" makes sense here
-        res.status = 204;
+        std::string body;
+        write_gauge(body, "bonk_sim_threads", "Scheduler worker threads.", scheduler.thread_count());
+        write_gauge(body, "bonk_active_sims", "Sims being stepped.", sim_stats.size());
+        write_gauge(body, "bonk_parked_sims", "Sims waiting for real time or their client to catch up.",
+                    scheduler.parked_count());
+        write_gauge(body, "bonk_scheduler_queue_depth", "Sims ready to step.", scheduler.queue_depth());
+        write_gauge(body, "bonk_sessions", "Connected or configured clients.", sessions.size());
+        write_gauge(body, "bonk_timers", "Timers on the timer thread, a heartbeat per connection plus sweeps.",
+                    timers.size());
+        write_gauge(body, "bonk_stream_pending_events", "Events queued for each client.", "client", pending_events);
+        write_gauge(body, "bonk_sim_realtime_factor", "Sim time per second of wall time, for each sim.", "client",
+                    realtime_factors);
+        write_metrics(body);
+        res.set_content(body, "text/plain; version=0.0.4");
     });
 
     server.set_logger([&](const httplib::Request& req, const httplib::Response& res) {
@@ -184,9 +334,3 @@ int main() {
     server.listen("0.0.0.0", 3001);
 }
 
-//     // Save to numpy file
-//     std::vector<size_t> shape({all_blocks.size()});
-//     npy::tensor<double> all_blocks_tensor(shape);
-//     all_blocks_tensor.copy_from(all_blocks);
-//     npy::save("tmp/out.npy", all_blocks_tensor);
-// }
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fmt/format.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+
+// Upper bounds of the histogram buckets in nanoseconds, 1, 2.5 and 5 per decade from 1µs to 10s.
+// Anything slower lands in the implicit +Inf bucket.
+static constexpr std::array<uint64_t, 22> BUCKET_BOUNDS = {
+    1'000,       2'500,       5'000,         10'000,        25'000,        50'000,
+    100'000,     250'000,     500'000,       1'000'000,     2'500'000,     5'000'000,
+    10'000'000,  25'000'000,  50'000'000,    100'000'000,   250'000'000,   500'000'000,
+    1'000'000'000, 2'500'000'000, 5'000'000'000, 10'000'000'000,
+};
+
+static constexpr std::array<std::string_view, STAGE_COUNT> STAGE_NAMES = {
+    "integrate", "resample", "decimate", "encode", "queue_wait", "socket_write",
+};
+
+struct CounterInfo {
+    std::string_view name;
+    std::string_view help;
+};
+
+static constexpr std::array<CounterInfo, METRIC_COUNTER_COUNT> COUNTERS = {{
+    {"bonk_blocks_total", "Blocks stepped by the scheduler."},
+    {"bonk_late_blocks_total", "Blocks finished after the time they were due to be played."},
+    {"bonk_dropped_viz_blocks_total", "Viz blocks dropped because a client fell behind."},
+    {"bonk_events_written_total", "Events written to client connections."},
+    {"bonk_bytes_written_total", "Encoded bytes written to client connections."},
+}};
+
+// Every value is written by the owning thread alone, so a relaxed load and store is enough to add to
+// it and readers on other threads never see a torn value
+struct alignas(64) MetricsShard {
+    // One count per bucket, not cumulative, the last one being +Inf
+    std::array<std::array<std::atomic<uint64_t>, BUCKET_BOUNDS.size() + 1>, STAGE_COUNT> buckets{};
+    std::array<std::atomic<uint64_t>, STAGE_COUNT> sum_ns{};
+    std::array<std::atomic<uint64_t>, METRIC_COUNTER_COUNT> counters{};
+    // Cleared when the owning thread exits, so the next new thread can carry on from its totals
+    std::atomic<bool> owned{true};
+};
+
+struct MetricsShardList {
+    // Only held to add or claim a shard, or to walk the list on scrape
+    std::mutex mutex;
+    std::vector<std::unique_ptr<MetricsShard>> shards;
+};
+
+// Never destroyed, since threads may still record while the process exits
+static MetricsShardList& shard_list() {
+    static MetricsShardList* list = new MetricsShardList();
+    return *list;
+}
+
+// Hands a shard to the thread that creates it, and gives it back when that thread exits
+class MetricsShardHandle {
+  public:
+    MetricsShardHandle() {
+        MetricsShardList& list = shard_list();
+        std::lock_guard<std::mutex> lk(list.mutex);
+        for (auto& shard : list.shards) {
+            // Acquire so this thread sees everything the previous owner recorded
+            if (!shard->owned.load(std::memory_order_acquire)) {
+                shard->owned.store(true, std::memory_order_relaxed);
+                this->shard = shard.get();
+                return;
+            }
+        }
+        list.shards.push_back(std::make_unique<MetricsShard>());
+        this->shard = list.shards.back().get();
+    }
+
+    ~MetricsShardHandle() {
+        this->shard->owned.store(false, std::memory_order_release);
+    }
+
+    MetricsShard* shard;
+};
+
+static MetricsShard& local_shard() {
+    thread_local MetricsShardHandle handle;
+    return *handle.shard;
+}
+
+static void add(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void observe_stage(Stage stage, std::chrono::steady_clock::duration duration) {
+    auto ns = static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::nanoseconds(duration).count()));
+    size_t bucket = std::lower_bound(BUCKET_BOUNDS.begin(), BUCKET_BOUNDS.end(), ns) - BUCKET_BOUNDS.begin();
+    MetricsShard& shard = local_shard();
+    auto s = static_cast<size_t>(stage);
+    add(shard.buckets[s][bucket], 1);
+    add(shard.sum_ns[s], ns);
+}
+
+void increment_counter(MetricCounter counter, uint64_t n) {
+    add(local_shard().counters[static_cast<size_t>(counter)], n);
+}
+
+StageTimer::StageTimer(Stage stage)
+    : stage(stage)
+    , start(std::chrono::steady_clock::now()) {}
+
+StageTimer::~StageTimer() {
+    observe_stage(this->stage, std::chrono::steady_clock::now() - this->start);
+}
+
+void write_metrics(std::string& out) {
+    std::array<std::array<uint64_t, BUCKET_BOUNDS.size() + 1>, STAGE_COUNT> buckets{};
+    std::array<uint64_t, STAGE_COUNT> sum_ns{};
+    std::array<uint64_t, METRIC_COUNTER_COUNT> counters{};
+    {
+        MetricsShardList& list = shard_list();
+        std::lock_guard<std::mutex> lk(list.mutex);
+        for (const auto& shard : list.shards) {
+            for (size_t s = 0; s < STAGE_COUNT; s++) {
+                for (size_t b = 0; b < buckets[s].size(); b++) {
+                    buckets[s][b] += shard->buckets[s][b].load(std::memory_order_relaxed);
+                }
+                sum_ns[s] += shard->sum_ns[s].load(std::memory_order_relaxed);
+            }
+            for (size_t c = 0; c < METRIC_COUNTER_COUNT; c++) {
+                counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "# HELP bonk_stage_seconds Time spent on one block or event in each stage.\n");
+    fmt::format_to(it, "# TYPE bonk_stage_seconds histogram\n");
+    for (size_t s = 0; s < STAGE_COUNT; s++) {
+        // Prometheus buckets are cumulative
+        uint64_t count = 0;
+        for (size_t b = 0; b < BUCKET_BOUNDS.size(); b++) {
+            count += buckets[s][b];
+            fmt::format_to(it, "bonk_stage_seconds_bucket{{stage=\"{}\",le=\"{}\"}} {}\n", STAGE_NAMES[s],
+                           BUCKET_BOUNDS[b] / 1e9, count);
+        }
+        count += buckets[s].back();
+        fmt::format_to(it, "bonk_stage_seconds_bucket{{stage=\"{}\",le=\"+Inf\"}} {}\n", STAGE_NAMES[s], count);
+        fmt::format_to(it, "bonk_stage_seconds_sum{{stage=\"{}\"}} {}\n", STAGE_NAMES[s], sum_ns[s] / 1e9);
+        fmt::format_to(it, "bonk_stage_seconds_count{{stage=\"{}\"}} {}\n", STAGE_NAMES[s], count);
+    }
+
+    for (size_t c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        fmt::format_to(it, "# HELP {} {}\n# TYPE {} counter\n{} {}\n", COUNTERS[c].name, COUNTERS[c].help,
+                       COUNTERS[c].name, COUNTERS[c].name, counters[c]);
+    }
+}
+
+void write_gauge(std::string& out, std::string_view name, std::string_view help, double value) {
+    fmt::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} gauge\n{} {}\n", name, help, name, name, value);
+}
+
+void write_gauge(std::string& out, std::string_view name, std::string_view help, std::string_view label,
+                 const std::vector<std::pair<std::string, double>>& values) {
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "# HELP {} {}\n# TYPE {} gauge\n", name, help, name);
+    for (const auto& [label_value, value] : values) {
+        // Label values are quoted, so backslashes, quotes and newlines in them must be escaped
+        fmt::format_to(it, "{}{{{}=\"", name, label);
+        for (char c : label_value) {
+            if (c == '\\' || c == '"') {
+                out.push_back('\\');
+                out.push_back(c);
+            } else if (c == '\n') {
+                out.append("\\n");
+            } else {
+                out.push_back(c);
+            }
+        }
+        fmt::format_to(it, "\"}} {}\n", value);
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Every block flows through these, each timed into its own histogram
+enum class Stage : uint8_t {
+    // Stepping the physics or modes of one block
+    Integrate = 0,
+    // Physics rate to audio rate, one physics block at a time
+    Resample = 1,
+    // Physics or audio rate to viz rate
+    Decimate = 2,
+    // Packing one event for the wire
+    Encode = 3,
+    // From an event being queued on its stream to the connection picking it up
+    QueueWait = 4,
+    // Handing one encoded event to the socket
+    SocketWrite = 5,
+};
+static constexpr size_t STAGE_COUNT = 6;
+
+enum class MetricCounter : uint8_t {
+    // Blocks stepped by the scheduler
+    Blocks = 0,
+    // Blocks finished after the time they were due to be played
+    LateBlocks = 1,
+    // Viz blocks thrown away because a client fell behind
+    DroppedVizBlocks = 2,
+    EventsWritten = 3,
+    BytesWritten = 4,
+};
+static constexpr size_t METRIC_COUNTER_COUNT = 5;
+
+// Recording goes to a shard owned by the calling thread, which is only ever written by that thread,
+// so it costs a few uncontended relaxed stores and never takes a lock. Shards are summed on scrape.
+void observe_stage(Stage stage, std::chrono::steady_clock::duration duration);
+void increment_counter(MetricCounter counter, uint64_t n = 1);
+
+// Times the rest of the scope it is declared in as stage
+class StageTimer {
+  public:
+    explicit StageTimer(Stage stage);
+    ~StageTimer();
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+  private:
+    Stage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Appends every stage histogram and counter, summed over all threads, in the Prometheus text format
+void write_metrics(std::string& out);
+// Appends a gauge in the Prometheus text format
+void write_gauge(std::string& out, std::string_view name, std::string_view help, double value);
+// Appends a gauge with one sample per label value, e.g. per client
+void write_gauge(std::string& out, std::string_view name, std::string_view help, std::string_view label,
+                 const std::vector<std::pair<std::string, double>>& values);
@@ -0,0 +1,117 @@
+#include "modal_sim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <spdlog/spdlog.h>
+
+#include "metrics.h"
+
+ModalSim::ModalSim(const SimParams& params, const ModalParams& modes) {
+    this->params = params;
+    // Nothing to integrate, so the scheduler steps one audio block at a time
+    this->params.physics_sample_rate = params.audio_sample_rate;
+    this->params.physics_block_size = params.audio_block_size;
+
+    double fs = params.audio_sample_rate;
+    std::vector<size_t> audible;
+    for (size_t i = 0; i < modes.freq.size(); i++) {
+        // Anything at or above Nyquist would alias, and an undamped or growing mode would never end
+        if (modes.amp[i] != 0.0 && modes.freq[i] > 0.0 && modes.freq[i] < fs / 2 && modes.decay[i] > 0.0) {
+            audible.push_back(i);
+        }
+    }
+    Eigen::VectorXd amp(audible.size());
+    Eigen::VectorXd phase(audible.size());
+    Eigen::VectorXd phase_step(audible.size());
+    Eigen::VectorXd damp(audible.size());
+    for (size_t j = 0; j < audible.size(); j++) {
+        size_t i = audible[j];
+        amp[j] = modes.amp[i];
+        phase[j] = modes.phase.empty() ? 0.0 : modes.phase[i];
+        phase_step[j] = 2 * std::numbers::pi * modes.freq[i] / fs;
+        damp[j] = std::exp(-modes.decay[i] / fs);
+    }
+    this->synth.load(amp, phase, phase_step, damp);
+    // Running no samples sizes the synth's scratch space, so step_block allocates nothing
+    this->synth.run(nullptr, 0);
+
+    this->rendered.reserve(params.audio_block_size);
+    this->audio_block.reserve(params.audio_block_size);
+    this->viz_block.reserve(params.viz_block_size);
+    this->tmp_viz_buffer.reserve(params.audio_block_size);
+    this->viz_decimator.setup(params.audio_sample_rate, params.viz_sample_rate);
+    this->audio_callback = [](auto&) {};
+    this->viz_callback = [](auto&) {};
+
+    spdlog::debug("modal sim with {} of {} modes audible", this->synth.activeCount(), modes.freq.size());
+}
+
+void ModalSim::set_audio_callback(std::function<void(const std::vector<float>&)> audio_callback) {
+    this->audio_callback = audio_callback;
+}
+
+void ModalSim::set_viz_callback(std::function<void(const std::vector<float>&)> viz_callback) {
+    this->viz_callback = viz_callback;
+}
+
+bool ModalSim::step_block(int n) {
+    if (!this->begin_step()) {
+        return false;
+    }
+
+    while (n > 0) {
+        // Never render past the end of the current audio block
+        size_t start = this->audio_block.size();
+        size_t count = std::min<size_t>(n, params.audio_block_size - start);
+        this->audio_block.resize(start + count);
+        std::span<float> chunk = std::span{this->audio_block}.subspan(start, count);
+        auto integrate_start = std::chrono::steady_clock::now();
+        this->rendered.assign(count, 0.0);
+        this->synth.run(this->rendered.data(), count);
+        std::copy(this->rendered.begin(), this->rendered.end(), chunk.begin());
+        auto decimate_start = std::chrono::steady_clock::now();
+        observe_stage(Stage::Integrate, decimate_start - integrate_start);
+
+        this->tmp_viz_buffer.clear();
+        this->viz_decimator.process(chunk, this->tmp_viz_buffer);
+        observe_stage(Stage::Decimate, std::chrono::steady_clock::now() - decimate_start);
+        for (float viz_sample : this->tmp_viz_buffer) {
+            this->push_viz_sample(viz_sample);
+        }
+
+        if (this->audio_block.size() == params.audio_block_size) {
+            this->audio_callback(this->audio_block);
+            this->audio_block.clear();
+        }
+        n -= count;
+    }
+
+    bool ringing = this->synth.activeCount() > 0;
+    if (!ringing && !this->audio_block.empty()) {
+        // Silence out the last partial block rather than dropping the end of the tail
+        this->audio_block.resize(params.audio_block_size, 0.0f);
+        this->audio_callback(this->audio_block);
+        this->audio_block.clear();
+    }
+
+    this->end_step();
+    return ringing;
+}
+
+void ModalSim::push_viz_sample(float sample) {
+    this->viz_block.push_back(sample);
+    if (this->viz_block.size() == params.viz_block_size) {
+        this->viz_callback(this->viz_block);
+        this->viz_block.clear();
+    }
+}
+
+const SimParams& ModalSim::get_params() const {
+    return this->params;
+}
+
+size_t ModalSim::active_modes() const {
+    return this->synth.activeCount();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "decimator.h"
+#include "modal.hpp"
+#include "sim.h"
+#include "source.h"
+
+// An excited object as a bank of exponentially decaying sinusoids, e.g. the modes of a bonked mesh
+struct ModalParams {
+    // Hz
+    std::vector<double> freq;
+    // Per second, each mode's amplitude falls off as exp(-decay * t). Must be positive, so the sound ends.
+    std::vector<double> decay;
+    std::vector<double> amp;
+    // Radians, or all zero if empty
+    std::vector<double> phase;
+};
+
+// Renders ModalParams straight at the audio rate, one audio block per scheduler step so the first
+// block is out as soon as the bonk is submitted. The synthesis itself is the bonk addon's ModalSynth.
+class ModalSim : public Source {
+  public:
+    // Only the audio, viz and lookahead fields of params are used
+    ModalSim(const SimParams& params, const ModalParams& modes);
+
+    void set_audio_callback(std::function<void(const std::vector<float>&)> audio_callback) override;
+    void set_viz_callback(std::function<void(const std::vector<float>&)> viz_callback) override;
+    bool step_block(int n) override;
+    const SimParams& get_params() const override;
+    size_t active_modes() const;
+
+  private:
+    void push_viz_sample(float sample);
+
+    SimParams params;
+    ModalSynth synth;
+    // ModalSynth adds into doubles, converted to audio_block afterwards
+    std::vector<double> rendered;
+
+    std::vector<float> audio_block;
+    std::vector<float> viz_block;
+    std::vector<float> tmp_viz_buffer;
+    Decimator viz_decimator;
+    std::function<void(const std::vector<float>&)> audio_callback;
+    std::function<void(const std::vector<float>&)> viz_callback;
+};
@@ -0,0 +1,159 @@
+#include "render.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fmt/core.h>
+#include <fstream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <vector>
+
+#include "audio_file.h"
+#include "config.h"
+#include "modal_sim.h"
+#include "sim.h"
+#include "source.h"
+
+struct RenderJob {
+    std::string output;
+    AudioFileFormat format;
+    ClientConfig config;
+    // Exactly one of these
+    std::optional<SimState> bonk;
+    std::optional<ModalParams> modal;
+    double max_seconds;
+};
+
+static std::optional<std::string> parse_job(const nlohmann::json& json, RenderJob& job) {
+    if (!json.is_object()) {
+        return "Job is not an object.";
+    }
+    if (!json.contains("output") || !json["output"].is_string()) {
+        return "output must be a path.";
+    }
+    job.output = json["output"];
+    auto format = AudioFileWriter::format_for(job.output);
+    if (!format) {
+        return fmt::format("Output \"{}\" is neither .wav nor .npy.", job.output);
+    }
+    job.format = *format;
+
+    if (!json.contains("config")) {
+        return "Missing config.";
+    }
+    if (auto error = parse_client_config(json["config"], job.config)) {
+        return error;
+    }
+    // Nobody is listening, so there is nothing to keep pace with
+    job.config.params.lookahead_ms = 0;
+
+    if (json.contains("bonk") == json.contains("modal")) {
+        return "Needs exactly one of bonk or modal.";
+    }
+    if (json.contains("bonk")) {
+        SimState state;
+        if (auto error = parse_sim_state(json["bonk"], state)) {
+            return error;
+        }
+        job.bonk = state;
+    } else {
+        ModalParams modes;
+        if (auto error = parse_modal_params(json["modal"], modes)) {
+            return error;
+        }
+        job.modal = std::move(modes);
+    }
+
+    job.max_seconds = json.value("maxSeconds", 60.0);
+    if (!(job.max_seconds > 0)) {
+        return "maxSeconds must be positive.";
+    }
+    return std::nullopt;
+}
+
+// Steps the job's source on the calling thread until it dies away or reaches max_seconds, writing each
+// audio block out as soon as it is produced
+static bool render_job(const RenderJob& job) {
+    std::shared_ptr<Source> source;
+    if (job.bonk) {
+        source = std::make_shared<Sim>(job.config.params, *job.bonk);
+    } else {
+        source = std::make_shared<ModalSim>(job.config.params, *job.modal);
+    }
+    const SimParams& params = source->get_params();
+
+    AudioFileWriter writer;
+    if (!writer.open(job.output, job.format, params.audio_sample_rate)) {
+        spdlog::error("could not create {}", job.output);
+        return false;
+    }
+    bool written = true;
+    source->set_audio_callback([&](const std::vector<float>& audio_block) {
+        written = written && writer.write(audio_block);
+    });
+
+    auto max_samples = static_cast<size_t>(job.max_seconds * params.audio_sample_rate);
+    while (written && writer.samples_written() < max_samples && source->step_block(params.physics_block_size)) {
+    }
+
+    if (!writer.close() || !written) {
+        spdlog::error("failed writing {}", job.output);
+        return false;
+    }
+    spdlog::info("rendered {} ({:.2f}s of audio)", job.output,
+                 static_cast<double>(writer.samples_written()) / params.audio_sample_rate);
+    return true;
+}
+
+int run_render(const std::string& jobs_path, size_t thread_count) {
+    std::ifstream jobs_file(jobs_path);
+    if (!jobs_file) {
+        spdlog::error("could not open {}", jobs_path);
+        return 1;
+    }
+    auto jobs_json = nlohmann::json::parse(jobs_file, nullptr, false);
+    if (jobs_json.is_discarded() || !jobs_json.is_array()) {
+        spdlog::error("{} must hold a JSON array of jobs", jobs_path);
+        return 1;
+    }
+
+    // Everything is checked before anything renders, so a typo doesn't surface halfway through a batch
+    std::vector<RenderJob> jobs(jobs_json.size());
+    bool valid = true;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (auto error = parse_job(jobs_json[i], jobs[i])) {
+            spdlog::error("job {}: {}", i, *error);
+            valid = false;
+        }
+    }
+    if (!valid) {
+        return 1;
+    }
+
+    // Each thread takes the next job as soon as it finishes one, so long and short jobs even out
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_job{0};
+    std::atomic<size_t> failed{0};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < std::min(thread_count, jobs.size()); t++) {
+        threads.emplace_back([&]() {
+            for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+                if (!render_job(jobs[i])) {
+                    failed++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("rendered {} of {} jobs on {} threads in {:.2f}s", jobs.size() - failed, jobs.size(), threads.size(),
+                 elapsed);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Renders every job in the JSON file at jobs_path straight to a .wav or .npy file, on thread_count
+// threads at once and with no HTTP or encoding in between. The file holds an array of jobs like
+//
+//   {
+//     "output": "out/0.wav",
+//     "config": {...},        as PUT /api/sim/config/:id takes it
+//     "bonk": {"x": 1, "v": 0}, as POST /api/sim/bonk/:id takes it
+//     "modal": {...},         or as POST /api/sim/modal/:id takes it, instead of bonk
+//     "maxSeconds": 60        optional, where to cut off a source that rings for longer
+//   }
+//
+// and each job's audio is written as it is produced, until its source dies away. Returns the exit code
+// for the process, which is nonzero if any job could not be read or rendered.
+int run_render(const std::string& jobs_path, size_t thread_count);
@@ -0,0 +1,168 @@
+#include "session_registry.h"
+
+#include <spdlog/spdlog.h>
+#include <utility>
+
+Session::Session(std::string id)
+    : id(std::move(id)) {}
+
+const std::string& Session::get_id() const {
+    return this->id;
+}
+
+void Session::set_config(ClientConfig config) {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    this->config = std::move(config);
+    this->last_active = std::chrono::steady_clock::now();
+}
+
+std::optional<ClientConfig> Session::get_config() const {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    return this->config;
+}
+
+std::shared_ptr<EventStream> Session::open_stream() {
+    auto stream = std::make_shared<EventStream>();
+    std::shared_ptr<EventStream> old_stream;
+    std::shared_ptr<Source> old_sim;
+    {
+        std::lock_guard<std::mutex> lk(this->mutex);
+        old_stream = std::exchange(this->stream, stream);
+        // The sim's callbacks write to the old stream, so nobody would hear it
+        if (old_stream != nullptr) {
+            old_sim = std::move(this->sim);
+        }
+        this->last_active = std::chrono::steady_clock::now();
+    }
+
+    if (old_stream != nullptr) {
+        old_stream->close();
+        spdlog::debug("replaced the stream of session {}", this->id);
+    }
+    if (old_sim != nullptr) {
+        old_sim->stop();
+    }
+    return stream;
+}
+
+std::shared_ptr<EventStream> Session::get_stream() const {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    return this->stream;
+}
+
+void Session::replace_sim(std::shared_ptr<Source> sim) {
+    std::shared_ptr<Source> old_sim;
+    {
+        std::lock_guard<std::mutex> lk(this->mutex);
+        old_sim = std::exchange(this->sim, std::move(sim));
+        this->last_active = std::chrono::steady_clock::now();
+    }
+    // Outside the lock since stopping waits for the sim's current block to finish
+    if (old_sim != nullptr) {
+        old_sim->stop();
+        spdlog::debug("cancelled replaced sim of session {}", this->id);
+    }
+}
+
+std::shared_ptr<Source> Session::get_sim() const {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    return this->sim;
+}
+
+bool Session::release_finished_sim() {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    // Every other owner (the scheduler, a handler starting it) has let go, so it will never step again
+    if (this->sim == nullptr || this->sim.use_count() > 1) {
+        return false;
+    }
+    this->sim = nullptr;
+    return true;
+}
+
+std::chrono::steady_clock::duration Session::idle_for() const {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    return std::chrono::steady_clock::now() - this->last_active;
+}
+
+void Session::close() {
+    std::shared_ptr<EventStream> stream;
+    std::shared_ptr<Source> sim;
+    {
+        std::lock_guard<std::mutex> lk(this->mutex);
+        stream = this->stream;
+        sim = std::move(this->sim);
+    }
+
+    // A sim blocked on a full stream only notices the stop once the stream is closed
+    if (stream != nullptr) {
+        stream->close();
+    }
+    if (sim != nullptr) {
+        sim->stop();
+    }
+}
+
+SessionRegistry::SessionRegistry(size_t shard_count)
+    : shards(std::make_unique<Shard[]>(shard_count))
+    , shard_count(shard_count) {}
+
+SessionRegistry::Shard& SessionRegistry::shard_for(const std::string& id) const {
+    return this->shards[std::hash<std::string>{}(id) % this->shard_count];
+}
+
+std::shared_ptr<Session> SessionRegistry::get_or_create(const std::string& id) {
+    Shard& shard = this->shard_for(id);
+    {
+        std::shared_lock<std::shared_mutex> lk(shard.mutex);
+        auto it = shard.sessions.find(id);
+        if (it != shard.sessions.end()) {
+            return it->second;
+        }
+    }
+
+    // Another thread may have created it in between, try_emplace keeps whichever came first
+    std::unique_lock<std::shared_mutex> lk(shard.mutex);
+    auto [it, inserted] = shard.sessions.try_emplace(id, nullptr);
+    if (inserted) {
+        it->second = std::make_shared<Session>(id);
+    }
+    return it->second;
+}
+
+std::shared_ptr<Session> SessionRegistry::find(const std::string& id) const {
+    Shard& shard = this->shard_for(id);
+    std::shared_lock<std::shared_mutex> lk(shard.mutex);
+    auto it = shard.sessions.find(id);
+    return it != shard.sessions.end() ? it->second : nullptr;
+}
+
+void SessionRegistry::remove(const std::shared_ptr<Session>& session) {
+    {
+        Shard& shard = this->shard_for(session->get_id());
+        std::unique_lock<std::shared_mutex> lk(shard.mutex);
+        auto it = shard.sessions.find(session->get_id());
+        // A reconnected client may already have a new session under the same id
+        if (it != shard.sessions.end() && it->second == session) {
+            shard.sessions.erase(it);
+        }
+    }
+    session->close();
+}
+
+size_t SessionRegistry::size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < this->shard_count; i++) {
+        std::shared_lock<std::shared_mutex> lk(this->shards[i].mutex);
+        total += this->shards[i].sessions.size();
+    }
+    return total;
+}
+
+void SessionRegistry::for_each(const std::function<void(const std::shared_ptr<Session>&)>& callback) const {
+    for (size_t i = 0; i < this->shard_count; i++) {
+        std::shared_lock<std::shared_mutex> lk(this->shards[i].mutex);
+        for (const auto& [id, session] : this->shards[i].sessions) {
+            callback(session);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "event_stream.h"
+#include "sim.h"
+#include "source.h"
+
+// Everything a client sets through /api/sim/config/:id
+struct ClientConfig {
+    SimParams params;
+    SampleEncoding audio_encoding{SampleEncoding::F32};
+    SampleEncoding viz_encoding{SampleEncoding::F32};
+};
+
+// State of one client. Handles stay valid after the session is removed from the registry, so a
+// handler that looked one up can keep using it without holding any registry lock.
+class Session {
+  public:
+    explicit Session(std::string id);
+
+    const std::string& get_id() const;
+
+    void set_config(ClientConfig config);
+    std::optional<ClientConfig> get_config() const;
+
+    // A fresh event stream for a new connection to read, since a stream has exactly one consumer. It
+    // replaces the stream of any connection that is still open, e.g. from before a page reload, which is
+    // closed so that connection ends, and the sim feeding it is stopped.
+    std::shared_ptr<EventStream> open_stream();
+    // The newest connection's stream, or nullptr until a client connects
+    std::shared_ptr<EventStream> get_stream() const;
+
+    // Makes sim the session's sim, then stops the sim it replaces. Once this returns the old sim never
+    // steps again, so the new one can take over as the stream's only producer.
+    void replace_sim(std::shared_ptr<Source> sim);
+    std::shared_ptr<Source> get_sim() const;
+    // Drops the session's sim once the scheduler is done with it, returns whether it did
+    bool release_finished_sim();
+
+    // Time since the client last configured the session, connected to it or started a sim on it
+    std::chrono::steady_clock::duration idle_for() const;
+
+    // Releases a sim waiting on the stream, then stops it
+    void close();
+
+  private:
+    const std::string id;
+    // Only held to read or swap members, never while waiting on a sim or stream
+    mutable std::mutex mutex;
+    std::optional<ClientConfig> config;
+    std::shared_ptr<EventStream> stream;
+    std::shared_ptr<Source> sim;
+    std::chrono::steady_clock::time_point last_active{std::chrono::steady_clock::now()};
+};
+
+// Sessions by client id, split across independently locked shards so handler threads for different
+// clients rarely contend.
+class SessionRegistry {
+  public:
+    explicit SessionRegistry(size_t shard_count = 64);
+
+    std::shared_ptr<Session> get_or_create(const std::string& id);
+    // Nullptr if there is no session for id
+    std::shared_ptr<Session> find(const std::string& id) const;
+    // Removes session if it is still the one registered under its id, and closes it
+    void remove(const std::shared_ptr<Session>& session);
+    size_t size() const;
+    // Locks one shard at a time, so callback must not touch the registry
+    void for_each(const std::function<void(const std::shared_ptr<Session>&)>& callback) const;
+
+  private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<Session>> sessions;
+    };
+
+    Shard& shard_for(const std::string& id) const;
+
+    // Shards are never moved, their mutexes pin them in place
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_count;
+};
@@ -1,29 +1,42 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <fmt/core.h>
 #include <optional>
 #include <spdlog/fmt/bundled/format.h>
 #include <spdlog/spdlog.h>
 
+#include "metrics.h"
 #include "sim.h"
 #include "soxrpp.h"
 
 Sim::Sim(const SimParams& params, const SimState& initial_state) {
     this->params = params;
+    if (params.integrator == Integrator::Exact) {
+        // The exact update is stable at any step size, so integrate directly at the audio rate
+        this->params.physics_sample_rate = params.audio_sample_rate;
+    }
     this->state = initial_state;
     this->state.physics_block.reserve(params.physics_block_size);
     this->state.audio_block.reserve(params.audio_block_size);
     this->tmp_audio_buffer.resize(params.audio_block_size);
+    // At most one decimated sample per physics sample
+    this->tmp_viz_buffer.reserve(params.physics_block_size);
     this->state.viz_block.reserve(params.viz_block_size);
-    this->audio_decimator.setup(params.physics_sample_rate, params.audio_sample_rate);
-    this->viz_decimator.setup(params.physics_sample_rate, params.viz_sample_rate);
+    this->viz_decimator.setup(this->params.physics_sample_rate, params.viz_sample_rate);
     // Uninitialized std::function values are NOT just no-ops, and throw std::bad_function_call
     this->physics_callback = [](auto&) {};
     this->audio_callback = [](auto&) {};
     this->viz_callback = [](auto&) {};
 
-    this->audio_resampler =
-        std::make_unique<soxrpp::SoxResampler<float, float>>(params.physics_sample_rate, params.audio_sample_rate, 1);
+    if (params.integrator == Integrator::Exact) {
+        this->update_transition(1. / this->params.physics_sample_rate);
+    } else {
+        this->audio_resampler =
+            std::make_unique<soxrpp::SoxResampler<float, float>>(params.physics_sample_rate, params.audio_sample_rate, 1);
+    }
 
-    spdlog::debug("params.physics_sample_rate = {}", params.physics_sample_rate);
+    spdlog::debug("params.physics_sample_rate = {}", this->params.physics_sample_rate);
     spdlog::debug("params.physics_block_size = {}", params.physics_block_size);
     spdlog::debug("params.audio_sample_rate = {}", params.audio_sample_rate);
     spdlog::debug("params.audio_block_size = {}", params.audio_block_size);
@@ -33,6 +46,7 @@ Sim::Sim(const SimParams& params, const SimState& initial_state) {
     spdlog::debug("params.stiffness = {}", params.stiffness);
     spdlog::debug("params.damping = {}", params.damping);
     spdlog::debug("params.area = {}", params.area);
+    spdlog::debug("params.integrator = {}", params.integrator == Integrator::Exact ? "exact" : "euler");
     spdlog::debug("state.x = {}", state.x);
     spdlog::debug("state.v = {}", state.v);
 }
@@ -56,65 +70,171 @@ void Sim::set_viz_callback(std::function<void(const std::vector<float>&)> viz_ca
 }
 
 bool Sim::step(double dt) {
-    if (this->stopped) {
+    if (!this->begin_step()) {
         return false;
     }
 
-    float c = params.damping;
-    float k = params.stiffness;
-    float m = params.mass;
-    // Integrate mẍ + cẋ + kx = 0 with Semi-Implicit Euler
-    state.v = state.v - c / m * state.v * dt - k / m * state.x * dt;
-    state.x = state.x + state.v * dt;
+    if (params.integrator == Integrator::Exact) {
+        if (dt != this->transition_dt) {
+            this->update_transition(dt);
+        }
+        auto [a, b, c, d] = this->transition;
+        double x = state.x;
+        state.x = a * x + b * state.v;
+        state.v = c * x + d * state.v;
+    } else {
+        float c = params.damping;
+        float k = params.stiffness;
+        float m = params.mass;
+        // Integrate mẍ + cẋ + kx = 0 with Semi-Implicit Euler
+        state.v = state.v - c / m * state.v * dt - k / m * state.x * dt;
+        state.x = state.x + state.v * dt;
+    }
 
+    // Viz before the physics block is flushed, in the same order step_block() emits them
     state.physics_block.push_back(state.x);
+    std::optional<float> viz_sample = this->viz_decimator.filter(state.x);
+    if (viz_sample) {
+        this->push_viz_sample(*viz_sample);
+    }
+
     if (state.physics_block.size() == params.physics_block_size) {
-        this->physics_callback(state.physics_block);
-        soxrpp::SoxrBuffer<float> ibuf(std::span{state.physics_block});
-        soxrpp::SoxrBuffer<float> obuf(std::span{this->tmp_audio_buffer});
-        auto [_, odone] = this->audio_resampler->process(ibuf, obuf);
-        for (int i = 0; i < odone; i++) {
-            float sample = this->tmp_audio_buffer[i];
-            state.audio_block.push_back(sample);
-            this->audio_power = 0.999 * this->audio_power + 0.001 * sample * sample;
-            if (state.audio_block.size() == params.audio_block_size) {
-                this->audio_callback(state.audio_block);
-                state.audio_block.clear();
-            }
-        }
+        this->flush_physics_block();
+    }
 
-        state.physics_block.clear();
+    this->end_step();
+    return this->audio_power > 1e-6;
+}
+
+bool Sim::step_block(int n) {
+    if (!this->begin_step()) {
+        return false;
     }
 
-    std::optional<float> viz_sample = this->viz_decimator.filter(state.x);
-    if (viz_sample) {
-        state.viz_block.push_back(*viz_sample);
-        if (state.viz_block.size() == params.viz_block_size) {
-            this->viz_callback(state.viz_block);
-            state.viz_block.clear();
+    if (params.integrator == Integrator::Exact && this->transition_dt != 1. / params.physics_sample_rate) {
+        this->update_transition(1. / params.physics_sample_rate);
+    }
+
+    // Same arithmetic as step(), with the divisions hoisted out of the loop
+    const double dt = 1. / params.physics_sample_rate;
+    const float c_over_m = params.damping / params.mass;
+    const float k_over_m = params.stiffness / params.mass;
+
+    while (n > 0) {
+        // Never integrate past the end of the current physics block
+        size_t start = state.physics_block.size();
+        size_t count = std::min<size_t>(n, params.physics_block_size - start);
+        state.physics_block.resize(start + count);
+        std::span<float> chunk = std::span{state.physics_block}.subspan(start, count);
+
+        auto integrate_start = std::chrono::steady_clock::now();
+        double x = state.x;
+        double v = state.v;
+        if (params.integrator == Integrator::Exact) {
+            auto [a, b, c, d] = this->transition;
+            for (float& sample : chunk) {
+                double x_next = a * x + b * v;
+                v = c * x + d * v;
+                x = x_next;
+                sample = x;
+            }
+        } else {
+            for (float& sample : chunk) {
+                v = v - c_over_m * v * dt - k_over_m * x * dt;
+                x = x + v * dt;
+                sample = x;
+            }
+        }
+        state.x = x;
+        state.v = v;
+        auto decimate_start = std::chrono::steady_clock::now();
+        observe_stage(Stage::Integrate, decimate_start - integrate_start);
+
+        this->tmp_viz_buffer.clear();
+        this->viz_decimator.process(chunk, this->tmp_viz_buffer);
+        observe_stage(Stage::Decimate, std::chrono::steady_clock::now() - decimate_start);
+        for (float viz_sample : this->tmp_viz_buffer) {
+            this->push_viz_sample(viz_sample);
         }
+
+        if (state.physics_block.size() == params.physics_block_size) {
+            this->flush_physics_block();
+        }
+        n -= count;
     }
 
+    this->end_step();
     return this->audio_power > 1e-6;
 }
 
-void Sim::stop() {
-    this->stopped = true;
+void Sim::update_transition(double dt) {
+    // The state [x, v] evolves as d/dt [x, v] = A [x, v] with A = [[0, 1], [-k/m, -c/m]], so one step
+    // of length dt is exactly exp(A dt). Writing A = sI + B with s = tr(A)/2 leaves B traceless, so
+    // B² = qI and exp(A dt) = exp(s dt) (C I + S B), where C and S depend on the sign of q.
+    double c = params.damping;
+    double k = params.stiffness;
+    double m = params.mass;
+    double s = -c / (2 * m);
+    double q = s * s - k / m;
+
+    double C, S;
+    if (q < 0) {
+        // Underdamped, rings at ω = sqrt(-q)
+        double omega = std::sqrt(-q);
+        C = std::cos(omega * dt);
+        S = std::sin(omega * dt) / omega;
+    } else if (q > 0) {
+        // Overdamped
+        double r = std::sqrt(q);
+        C = std::cosh(r * dt);
+        S = std::sinh(r * dt) / r;
+    } else {
+        // Critically damped
+        C = 1.0;
+        S = dt;
+    }
+
+    double decay = std::exp(s * dt);
+    this->transition = {
+        decay * (C - s * S),
+        decay * S,
+        decay * (-k / m * S),
+        decay * (C + (-c / m - s) * S),
+    };
+    this->transition_dt = dt;
 }
 
-void Decimator::setup(int source_rate, int target_rate) {
-    this->decimation_factor = source_rate / target_rate;
-    this->samples_until_output = this->decimation_factor;
-    this->lowpass_filter.setup(source_rate, target_rate / 2.0f);
+void Sim::flush_physics_block() {
+    this->physics_callback(state.physics_block);
+    std::span<const float> audio_samples{state.physics_block};
+    if (this->audio_resampler) {
+        StageTimer timer(Stage::Resample);
+        soxrpp::SoxrBuffer<float> ibuf(std::span{state.physics_block});
+        soxrpp::SoxrBuffer<float> obuf(std::span{this->tmp_audio_buffer});
+        auto [_, odone] = this->audio_resampler->process(ibuf, obuf);
+        audio_samples = std::span{this->tmp_audio_buffer}.first(odone);
+    }
+
+    for (float sample : audio_samples) {
+        state.audio_block.push_back(sample);
+        this->audio_power = 0.999 * this->audio_power + 0.001 * sample * sample;
+        if (state.audio_block.size() == params.audio_block_size) {
+            this->audio_callback(state.audio_block);
+            state.audio_block.clear();
+        }
+    }
+
+    state.physics_block.clear();
 }
 
-std::optional<float> Decimator::filter(float sample) {
-    float filtered_sample = this->lowpass_filter.filter(sample);
-    if (this->samples_until_output == 0) {
-        this->samples_until_output = this->decimation_factor - 1;
-        return filtered_sample;
-    } else {
-        this->samples_until_output--;
-        return std::nullopt;
+void Sim::push_viz_sample(float sample) {
+    state.viz_block.push_back(sample);
+    if (state.viz_block.size() == params.viz_block_size) {
+        this->viz_callback(state.viz_block);
+        state.viz_block.clear();
     }
-}
\ No newline at end of file
+}
+
+const SimParams& Sim::get_params() const {
+    return this->params;
+}
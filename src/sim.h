@@ -1,10 +1,15 @@
 #pragma once
 
+#include <array>
 #include <functional>
-#include <iir/Butterworth.h>
+#include <memory>
 #include <soxrpp.h>
+#include <span>
 #include <vector>
 
+#include "decimator.h"
+#include "source.h"
+
 struct SimState {
     double x;
     double v;
@@ -14,6 +19,13 @@ struct SimState {
     std::vector<float> viz_block;
 };
 
+enum class Integrator {
+    // Semi-implicit Euler, needs a physics rate far above the audio rate to stay accurate
+    SemiImplicitEuler,
+    // Exact discretization of the linear system, runs at the audio rate without resampling
+    Exact,
+};
+
 struct SimParams {
     int physics_sample_rate;
     int physics_block_size;
@@ -26,42 +38,42 @@ struct SimParams {
     float stiffness; // spring constant
     float damping;   // spring damping
     float area;      // surface area of object
-};
 
-class Decimator {
-  public:
-    void setup(int source_rate, int target_rate);
-    std::optional<float> filter(float sample);
-
-  private:
-    // Number of samples before filter returns a decimated sample
-    int samples_until_output;
-    // Keep one sample per decimation_factor samples
-    int decimation_factor;
-    // Anti-aliasing filter
-    Iir::Butterworth::LowPass<8> lowpass_filter;
+    Integrator integrator{Integrator::SemiImplicitEuler};
+    // How far ahead of real time the sim may run, or zero to run as fast as possible
+    int lookahead_ms{0};
 };
 
-class Sim {
+class Sim : public Source {
   public:
     Sim(const SimParams& params, const SimState& initial_state);
 
     void set_physics_callback(std::function<void(const std::vector<float>&)> physics_callback);
-    void set_audio_callback(std::function<void(const std::vector<float>&)> audio_callback);
-    void set_viz_callback(std::function<void(const std::vector<float>&)> viz_callback);
+    void set_audio_callback(std::function<void(const std::vector<float>&)> audio_callback) override;
+    void set_viz_callback(std::function<void(const std::vector<float>&)> viz_callback) override;
     bool step(double dt);
-    void stop();
+    // Integrates n physics samples in one pass, producing the same output as n calls to step()
+    bool step_block(int n) override;
+    const SimParams& get_params() const override;
 
   private:
+    void update_transition(double dt);
+    void flush_physics_block();
+    void push_viz_sample(float sample);
+
     SimParams params;
     SimState state;
-    Decimator audio_decimator, viz_decimator;
+    Decimator viz_decimator;
     std::vector<float> tmp_audio_buffer;
+    std::vector<float> tmp_viz_buffer;
     std::unique_ptr<soxrpp::SoxResampler<float, float>> audio_resampler;
     std::function<void(const std::vector<float>&)> physics_callback;
     std::function<void(const std::vector<float>&)> audio_callback;
     std::function<void(const std::vector<float>&)> viz_callback;
 
+    // State-transition matrix of the exact integrator, row-major, for a step of transition_dt
+    std::array<double, 4> transition;
+    double transition_dt{0.0};
+
     double audio_power{1.0};
-    bool stopped{false};
 };
\ No newline at end of file
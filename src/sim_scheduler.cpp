@@ -0,0 +1,230 @@
+#include "sim_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <spdlog/spdlog.h>
+
+#include "metrics.h"
+
+SimScheduler::SimScheduler(size_t thread_count) {
+    for (size_t i = 0; i < thread_count; i++) {
+        this->workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        this->threads.emplace_back([this, i]() { this->run(i); });
+    }
+
+    spdlog::debug("started sim scheduler with {} threads", thread_count);
+}
+
+SimScheduler::~SimScheduler() {
+    {
+        std::lock_guard<std::mutex> lk(this->idle_mutex);
+        this->stopping = true;
+    }
+    this->idle_cv.notify_all();
+    for (std::thread& thread : this->threads) {
+        thread.join();
+    }
+}
+
+void SimScheduler::submit(const std::string& id, std::shared_ptr<Source> sim, std::shared_ptr<EventStream> stream) {
+    const SimParams& params = sim->get_params();
+    auto task = std::make_shared<Task>();
+    task->id = id;
+    task->stream = std::move(stream);
+    task->block_size = params.physics_block_size;
+    task->sample_rate = params.physics_sample_rate;
+    task->lookahead = std::chrono::milliseconds(std::max(0, params.lookahead_ms));
+
+    // Allow twice the blocks produced over one lookahead window before throttling, and never let the
+    // stream's audio ring fill up since its producer would have to wait for the client
+    task->max_pending = task->stream != nullptr ? task->stream->capacity() / 2 : 0;
+    if (task->lookahead > Clock::duration::zero()) {
+        double lookahead_seconds = params.lookahead_ms / 1000.0;
+        double audio_blocks = std::ceil(lookahead_seconds * params.audio_sample_rate / params.audio_block_size);
+        double viz_blocks = std::ceil(lookahead_seconds * params.viz_sample_rate / params.viz_block_size);
+        task->max_pending = std::min(task->max_pending, 2 * static_cast<size_t>(audio_blocks + viz_blocks) + 4);
+    }
+
+    task->sim = std::move(sim);
+    task->start = Clock::now();
+    {
+        std::lock_guard<std::mutex> lk(this->tasks_mutex);
+        this->tasks.push_back(task);
+    }
+
+    // Spread new sims round-robin, idle workers steal them if that worker is busy
+    size_t worker_idx = this->next_worker.fetch_add(1) % this->workers.size();
+    this->enqueue(worker_idx, std::move(task));
+}
+
+size_t SimScheduler::thread_count() const {
+    return this->threads.size();
+}
+
+size_t SimScheduler::queue_depth() const {
+    return this->queued.load();
+}
+
+size_t SimScheduler::parked_count() const {
+    std::lock_guard<std::mutex> lk(this->idle_mutex);
+    return this->parked.size();
+}
+
+std::vector<SimStats> SimScheduler::stats() const {
+    auto now = Clock::now();
+    std::vector<SimStats> result;
+    std::lock_guard<std::mutex> lk(this->tasks_mutex);
+    for (const auto& task : this->tasks) {
+        double wall_time = std::chrono::duration<double>(now - task->start).count();
+        double sim_time = static_cast<double>(task->samples.load()) / task->sample_rate;
+        result.push_back({
+            .id = task->id,
+            .sim_time = sim_time,
+            .lag = wall_time - sim_time,
+        });
+    }
+    return result;
+}
+
+void SimScheduler::run(size_t worker_idx) {
+    while (true) {
+        this->wake_parked(worker_idx);
+        std::shared_ptr<Task> task = this->next_task(worker_idx);
+        if (!task) {
+            std::unique_lock<std::mutex> lk(this->idle_mutex);
+            this->sleeping++;
+            // Also wake when a sim is parked ahead of the one this worker planned to wake for, or when that
+            // one was taken, so the wait always ends at the earliest parked sim
+            auto earliest = [this]() { return this->parked.empty() ? Clock::time_point::max() : this->parked.top().wake; };
+            auto planned = earliest();
+            auto has_work = [&]() { return this->stopping || this->queued > 0 || earliest() != planned; };
+            if (planned == Clock::time_point::max()) {
+                this->idle_cv.wait(lk, has_work);
+            } else {
+                this->idle_cv.wait_until(lk, planned, has_work);
+            }
+            this->sleeping--;
+            if (this->stopping) {
+                return;
+            }
+            continue;
+        }
+
+        bool should_step = task->sim->step_block(task->block_size);
+        task->samples += task->block_size;
+
+        // A block ending at sim_time is played at start + sim_time, so a block done after that is late
+        auto now = Clock::now();
+        auto sim_time = std::chrono::duration<double>(static_cast<double>(task->samples) / task->sample_rate);
+        auto played = task->start + std::chrono::duration_cast<Clock::duration>(sim_time);
+        increment_counter(MetricCounter::Blocks);
+        if (played < now) {
+            increment_counter(MetricCounter::LateBlocks);
+        }
+
+        if (!should_step) {
+            this->retire(task);
+            continue;
+        }
+
+        if (task->lookahead > Clock::duration::zero()) {
+            // Sleep until real time is within the lookahead of the sim
+            auto due = played - task->lookahead;
+            if (due > now) {
+                this->park(std::move(task), due);
+                continue;
+            }
+        }
+
+        // Or until the client has drained some of what is already queued for it
+        if (task->stream != nullptr && task->stream->pending() > task->max_pending) {
+            auto retry = std::max<Clock::duration>(task->lookahead / 4, std::chrono::milliseconds(5));
+            this->park(std::move(task), now + retry);
+            continue;
+        }
+
+        // Back of our own queue so every sim on this worker gets a turn
+        this->enqueue(worker_idx, std::move(task));
+    }
+}
+
+std::shared_ptr<SimScheduler::Task> SimScheduler::next_task(size_t worker_idx) {
+    // Own queue first, oldest task first
+    {
+        Worker& worker = *this->workers[worker_idx];
+        std::lock_guard<std::mutex> lk(worker.mutex);
+        if (!worker.queue.empty()) {
+            auto task = std::move(worker.queue.front());
+            worker.queue.pop_front();
+            this->queued--;
+            return task;
+        }
+    }
+
+    // Then steal the most recently queued task of another worker
+    for (size_t i = 1; i < this->workers.size(); i++) {
+        Worker& victim = *this->workers[(worker_idx + i) % this->workers.size()];
+        std::lock_guard<std::mutex> lk(victim.mutex);
+        if (!victim.queue.empty()) {
+            auto task = std::move(victim.queue.back());
+            victim.queue.pop_back();
+            this->queued--;
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+void SimScheduler::enqueue(size_t worker_idx, std::shared_ptr<Task> task) {
+    {
+        Worker& worker = *this->workers[worker_idx];
+        std::lock_guard<std::mutex> lk(worker.mutex);
+        worker.queue.push_back(std::move(task));
+        this->queued++;
+    }
+
+    if (this->sleeping > 0) {
+        // Taking the lock orders this with a worker that is about to wait
+        std::lock_guard<std::mutex> lk(this->idle_mutex);
+        this->idle_cv.notify_one();
+    }
+}
+
+void SimScheduler::park(std::shared_ptr<Task> task, Clock::time_point wake) {
+    std::lock_guard<std::mutex> lk(this->idle_mutex);
+    this->parked.push({wake, std::move(task)});
+    this->next_wake = this->parked.top().wake;
+    // A sleeping worker may need to wake earlier than it planned to
+    this->idle_cv.notify_one();
+}
+
+void SimScheduler::wake_parked(size_t worker_idx) {
+    auto now = Clock::now();
+    if (this->next_wake.load() > now) {
+        return;
+    }
+
+    std::vector<std::shared_ptr<Task>> due;
+    {
+        std::lock_guard<std::mutex> lk(this->idle_mutex);
+        while (!this->parked.empty() && this->parked.top().wake <= now) {
+            due.push_back(this->parked.top().task);
+            this->parked.pop();
+        }
+        this->next_wake = this->parked.empty() ? Clock::time_point::max() : this->parked.top().wake;
+    }
+
+    for (auto& task : due) {
+        this->enqueue(worker_idx, std::move(task));
+    }
+}
+
+void SimScheduler::retire(const std::shared_ptr<Task>& task) {
+    std::lock_guard<std::mutex> lk(this->tasks_mutex);
+    std::erase(this->tasks, task);
+
+    spdlog::debug("finished stepping sim {}", task->id);
+}
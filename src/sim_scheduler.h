@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "event_stream.h"
+#include "sim.h"
+#include "source.h"
+
+struct SimStats {
+    std::string id;
+    // Seconds of simulated time produced so far
+    double sim_time;
+    // Wall-clock seconds the sim is behind real time, negative when it is ahead
+    double lag;
+};
+
+// Fixed pool of worker threads that advance every active Source one physics block at a time. Each worker
+// round-robins over its own run queue and steals from the others when it runs dry. Sims with a
+// lookahead are parked whenever they get too far ahead of real time or their stream backs up.
+class SimScheduler {
+  public:
+    explicit SimScheduler(size_t thread_count);
+    ~SimScheduler();
+
+    // Runs sim until it is stopped or its audio decays. Replacing a sim is up to the caller, via Source::stop().
+    // The sim also waits for stream, if given, to drain whenever the client falls behind.
+    void submit(const std::string& id, std::shared_ptr<Source> sim, std::shared_ptr<EventStream> stream = nullptr);
+    size_t thread_count() const;
+    // Number of sims waiting for a worker
+    size_t queue_depth() const;
+    // Number of paced sims waiting for real time or their stream to catch up
+    size_t parked_count() const;
+    std::vector<SimStats> stats() const;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Task {
+        std::string id;
+        std::shared_ptr<Source> sim;
+        std::shared_ptr<EventStream> stream;
+        int block_size;
+        int sample_rate;
+        // Zero for sims that run as fast as possible
+        Clock::duration lookahead;
+        // Most events the stream may hold before the sim is throttled
+        size_t max_pending;
+        Clock::time_point start;
+        std::atomic<int64_t> samples{0};
+    };
+
+    struct ParkedTask {
+        Clock::time_point wake;
+        std::shared_ptr<Task> task;
+
+        bool operator>(const ParkedTask& other) const {
+            return this->wake > other.wake;
+        }
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Task>> queue;
+    };
+
+    void run(size_t worker_idx);
+    std::shared_ptr<Task> next_task(size_t worker_idx);
+    void enqueue(size_t worker_idx, std::shared_ptr<Task> task);
+    void park(std::shared_ptr<Task> task, Clock::time_point wake);
+    void wake_parked(size_t worker_idx);
+    void retire(const std::shared_ptr<Task>& task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_worker{0};
+
+    // Idle workers sleep here until something is queued or the earliest parked sim is due
+    mutable std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> sleeping{0};
+    std::atomic<bool> stopping{false};
+
+    // Guarded by idle_mutex. next_wake mirrors the earliest wake time so busy workers can skip the lock.
+    std::priority_queue<ParkedTask, std::vector<ParkedTask>, std::greater<>> parked;
+    std::atomic<Clock::time_point> next_wake{Clock::time_point::max()};
+
+    // Every submitted task that has not finished yet, for stats()
+    mutable std::mutex tasks_mutex;
+    std::vector<std::shared_ptr<Task>> tasks;
+};
@@ -0,0 +1,40 @@
+#include "source.h"
+
+void Source::stop() {
+    this->stopped = true;
+    this->stop_callback();
+
+    if (this->stepping.load() == std::this_thread::get_id()) {
+        return;
+    }
+    // Callers rely on no more blocks being emitted once this returns, e.g. to start a replacement source
+    // that feeds the same single-producer EventStream
+    std::thread::id current = this->stepping.load();
+    while (current != std::thread::id{}) {
+        this->stepping.wait(current);
+        current = this->stepping.load();
+    }
+}
+
+const std::atomic<bool>& Source::stop_requested() const {
+    return this->stopped;
+}
+
+void Source::set_stop_callback(std::function<void()> stop_callback) {
+    this->stop_callback = stop_callback;
+}
+
+bool Source::begin_step() {
+    // Marked as stepping before checking, so a stop() that doesn't see the step makes it see the stop
+    this->stepping = std::this_thread::get_id();
+    if (this->stopped) {
+        this->end_step();
+        return false;
+    }
+    return true;
+}
+
+void Source::end_step() {
+    this->stepping = std::thread::id{};
+    this->stepping.notify_all();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+struct SimParams;
+
+// Anything the scheduler can advance block by block into a client's stream
+class Source {
+  public:
+    virtual ~Source() = default;
+
+    virtual void set_audio_callback(std::function<void(const std::vector<float>&)> audio_callback) = 0;
+    virtual void set_viz_callback(std::function<void(const std::vector<float>&)> viz_callback) = 0;
+    // Produces n samples at get_params().physics_sample_rate, returns false once there is nothing left to play
+    virtual bool step_block(int n) = 0;
+    virtual const SimParams& get_params() const = 0;
+
+    // No block is emitted once this returns. Called from one of the source's own callbacks, it can't wait
+    // for the step it is in, and only keeps the next one from starting.
+    void stop();
+    // Set as soon as stop() is called, for callbacks that would otherwise wait, e.g. on a full EventStream
+    const std::atomic<bool>& stop_requested() const;
+    // Called by stop() before it waits for the current step, to wake a callback that is waiting on something
+    void set_stop_callback(std::function<void()> stop_callback);
+
+  protected:
+    // Every step runs between these. Once the source is stopped begin_step() returns false, and the step
+    // must return without emitting anything.
+    bool begin_step();
+    void end_step();
+
+  private:
+    std::atomic<bool> stopped{false};
+    // The thread running a step, or no thread
+    std::atomic<std::thread::id> stepping{};
+    std::function<void()> stop_callback = []() {};
+};
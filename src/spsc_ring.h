@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. Elements live in
+// slots allocated up front and are filled and read in place, so whatever an element owns (e.g. a
+// vector's capacity) is reused every time its slot comes around again.
+template <typename T>
+class SpscRing {
+  public:
+    // Capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity)
+        : slots(std::bit_ceil(capacity))
+        , mask(slots.size() - 1) {}
+
+    // Producer only. The next free slot to fill in place, or nullptr when the ring is full.
+    T* acquire() {
+        size_t h = this->head.load(std::memory_order_relaxed);
+        if (h - this->tail.load(std::memory_order_acquire) == this->slots.size()) {
+            return nullptr;
+        }
+        return &this->slots[h & this->mask];
+    }
+
+    // Producer only. Hands the slot from a successful acquire() to the consumer.
+    void publish() {
+        this->head.store(this->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer only. The oldest element, or nullptr when the ring is empty.
+    T* front() {
+        size_t t = this->tail.load(std::memory_order_relaxed);
+        if (t == this->head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &this->slots[t & this->mask];
+    }
+
+    // Consumer only. Must follow a successful front(). The slot keeps its contents for reuse.
+    void pop() {
+        this->tail.store(this->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Approximate when called concurrently with either side
+    size_t size() const {
+        size_t t = this->tail.load(std::memory_order_acquire);
+        return this->head.load(std::memory_order_acquire) - t;
+    }
+
+    size_t capacity() const {
+        return this->slots.size();
+    }
+
+  private:
+    std::vector<T> slots;
+    size_t mask;
+    // Kept on separate cache lines so the two sides don't false-share
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
@@ -0,0 +1,84 @@
+#include "timer_service.h"
+
+#include <spdlog/spdlog.h>
+
+TimerService::TimerService() {
+    this->thread = std::thread([this]() { this->run(); });
+}
+
+TimerService::~TimerService() {
+    {
+        std::lock_guard<std::mutex> lk(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_one();
+    this->thread.join();
+}
+
+uint64_t TimerService::every(Clock::duration interval, std::function<bool()> callback) {
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lk(this->mutex);
+        id = this->next_id++;
+        this->timers.emplace(id, Timer{
+                                     .interval = interval,
+                                     .callback = std::make_shared<std::function<bool()>>(std::move(callback)),
+                                 });
+        this->queue.push({Clock::now() + interval, id});
+    }
+    // The new timer may be due before whatever the thread is waiting for
+    this->cv.notify_one();
+    return id;
+}
+
+void TimerService::cancel(uint64_t id) {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    this->timers.erase(id);
+}
+
+size_t TimerService::size() const {
+    std::lock_guard<std::mutex> lk(this->mutex);
+    return this->timers.size();
+}
+
+void TimerService::run() {
+    std::unique_lock<std::mutex> lk(this->mutex);
+    while (!this->stopping) {
+        if (this->queue.empty()) {
+            this->cv.wait(lk, [this]() { return this->stopping || !this->queue.empty(); });
+            continue;
+        }
+
+        Due due = this->queue.top();
+        if (due.when > Clock::now()) {
+            this->cv.wait_until(lk, due.when);
+            continue;
+        }
+        this->queue.pop();
+        auto it = this->timers.find(due.id);
+        if (it == this->timers.end()) {
+            continue;
+        }
+
+        std::shared_ptr<std::function<bool()>> callback = it->second.callback;
+        lk.unlock();
+        bool again = (*callback)();
+        lk.lock();
+
+        // Looked up again since the callback may have been cancelled while it ran
+        it = this->timers.find(due.id);
+        if (it == this->timers.end()) {
+            continue;
+        }
+        if (!again) {
+            this->timers.erase(it);
+            continue;
+        }
+        // Keeps to the original schedule, unless it fell so far behind that it would fire in a burst
+        auto next = due.when + it->second.interval;
+        auto now = Clock::now();
+        this->queue.push({next > now ? next : now + it->second.interval, due.id});
+    }
+
+    spdlog::debug("stopped timer service with {} timers left", this->timers.size());
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// One thread that runs every periodic chore of the server (heartbeats, sweeps, logging), so the number
+// of threads stays fixed however many clients come and go. Callbacks run one at a time on that thread
+// and hold up every other timer while they run, so they must be quick and never block.
+class TimerService {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerService();
+    // Drops every timer, waiting for a callback that is running to finish
+    ~TimerService();
+
+    // Calls callback every interval, starting one interval from now, until it returns false or the
+    // returned id is cancelled
+    uint64_t every(Clock::duration interval, std::function<bool()> callback);
+    // A callback that is already running still finishes, but is never called again
+    void cancel(uint64_t id);
+    // Number of timers that have not finished or been cancelled
+    size_t size() const;
+
+  private:
+    struct Timer {
+        Clock::duration interval;
+        // Shared so the thread can keep calling it outside the lock while it is cancelled
+        std::shared_ptr<std::function<bool()>> callback;
+    };
+
+    struct Due {
+        Clock::time_point when;
+        uint64_t id;
+
+        bool operator>(const Due& other) const {
+            return this->when > other.when;
+        }
+    };
+
+    void run();
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::unordered_map<uint64_t, Timer> timers;
+    // Earliest first. Cancelled timers are left in and skipped once they come up.
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> queue;
+    uint64_t next_id{1};
+    bool stopping{false};
+    std::thread thread;
+};
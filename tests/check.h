@@ -0,0 +1,33 @@
+#pragma once
+
+#include <fmt/core.h>
+
+// Minimal assertions for the executables in tests/. A failed check is reported and counted rather than
+// aborting, so one run shows everything that broke, and main returns check_result() for CTest.
+inline int check_failures = 0;
+
+#define CHECK(condition)                                                                                   \
+    do {                                                                                                   \
+        if (!(condition)) {                                                                                \
+            fmt::print(stderr, "{}:{}: CHECK({}) failed\n", __FILE__, __LINE__, #condition);               \
+            check_failures++;                                                                              \
+        }                                                                                                  \
+    } while (0)
+
+// Like CHECK, with a message formatted from the remaining arguments
+#define CHECK_MSG(condition, ...)                                                                          \
+    do {                                                                                                   \
+        if (!(condition)) {                                                                                \
+            fmt::print(stderr, "{}:{}: CHECK({}) failed: {}\n", __FILE__, __LINE__, #condition,             \
+                       fmt::format(__VA_ARGS__));                                                          \
+            check_failures++;                                                                              \
+        }                                                                                                  \
+    } while (0)
+
+inline int check_result() {
+    if (check_failures > 0) {
+        fmt::print(stderr, "{} check(s) failed\n", check_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <cmath>
+#include <vector>
+
+#include "check.h"
+#include "sim.h"
+
+struct Oscillator {
+    float mass;
+    float stiffness;
+    float damping;
+    double x0;
+    double v0;
+};
+
+// Closed-form displacement of mẍ + cẋ + kx = 0 at time t, written in terms of the natural frequency and
+// damping ratio rather than the way Sim::update_transition factors it
+static double analytic(const Oscillator& o, double t) {
+    double m = o.mass;
+    double k = o.stiffness;
+    double c = o.damping;
+    double omega0 = std::sqrt(k / m);
+    double zeta = c / (2 * std::sqrt(k * m));
+    if (zeta < 1) {
+        double omega_d = omega0 * std::sqrt(1 - zeta * zeta);
+        return std::exp(-zeta * omega0 * t) *
+               (o.x0 * std::cos(omega_d * t) + (o.v0 + zeta * omega0 * o.x0) / omega_d * std::sin(omega_d * t));
+    } else if (zeta > 1) {
+        double r1 = -zeta * omega0 + omega0 * std::sqrt(zeta * zeta - 1);
+        double r2 = -zeta * omega0 - omega0 * std::sqrt(zeta * zeta - 1);
+        double a = (o.v0 - r2 * o.x0) / (r1 - r2);
+        return a * std::exp(r1 * t) + (o.x0 - a) * std::exp(r2 * t);
+    } else {
+        return (o.x0 + (o.v0 + omega0 * o.x0) * t) * std::exp(-omega0 * t);
+    }
+}
+
+// Largest difference from the analytic solution over the first seconds of sim output, sampled at
+// physics_rate. The exact integrator ignores physics_rate and runs at the audio rate.
+static double max_error(const Oscillator& o, Integrator integrator, int physics_rate, double seconds) {
+    SimParams params{
+        .physics_sample_rate = physics_rate,
+        .physics_block_size = 64,
+        .audio_sample_rate = 48000,
+        .audio_block_size = 256,
+        .viz_sample_rate = 1000,
+        .viz_block_size = 32,
+        .mass = o.mass,
+        .stiffness = o.stiffness,
+        .damping = o.damping,
+        .area = 1.0f,
+        .integrator = integrator,
+    };
+    Sim sim(params, {.x = o.x0, .v = o.v0});
+    std::vector<float> x;
+    sim.set_physics_callback([&](const std::vector<float>& block) { x.insert(x.end(), block.begin(), block.end()); });
+
+    int rate = sim.get_params().physics_sample_rate;
+    int total = static_cast<int>(seconds * rate) / 64 * 64;
+    sim.step_block(total);
+
+    double error = 0.0;
+    for (size_t i = 0; i < x.size(); i++) {
+        // Sample i is the state after i + 1 steps
+        double t = static_cast<double>(i + 1) / rate;
+        error = std::max(error, std::abs(x[i] - analytic(o, t)));
+    }
+    CHECK_MSG(x.size() == static_cast<size_t>(total), "{} of {} samples came out", x.size(), total);
+    return error;
+}
+
+int main() {
+    // Underdamped at about 500 Hz, overdamped, and exactly critically damped
+    Oscillator underdamped{.mass = 0.01f, .stiffness = 1e5f, .damping = 0.5f, .x0 = 0.1, .v0 = 20.0};
+    Oscillator overdamped{.mass = 0.01f, .stiffness = 1e5f, .damping = 100.0f, .x0 = 0.1, .v0 = -5.0};
+    Oscillator critical{.mass = 1.0f, .stiffness = 4.0f, .damping = 4.0f, .x0 = 0.1, .v0 = 1.0};
+
+    // The exact integrator is only off by the float rounding of its output, however long it runs
+    for (const Oscillator& o : {underdamped, overdamped, critical}) {
+        double error = max_error(o, Integrator::Exact, 48000, 1.0);
+        CHECK_MSG(error < 1e-6, "exact integrator is {} away from the analytic solution", error);
+    }
+
+    // Semi-implicit Euler is first order, so doubling the physics rate should about halve its error
+    double previous = INFINITY;
+    for (int rate : {48000, 96000, 192000, 384000, 768000}) {
+        double error = max_error(underdamped, Integrator::SemiImplicitEuler, rate, 0.05);
+        CHECK_MSG(error < previous / 1.8, "euler error {} at {} Hz, {} at half the rate", error, rate, previous);
+        previous = error;
+    }
+    CHECK_MSG(previous < 1e-3, "euler error is still {} at the highest rate", previous);
+
+    return check_result();
+}
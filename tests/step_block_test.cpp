@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <vector>
+
+#include "check.h"
+#include "sim.h"
+
+// Every callback a sim made, in order
+struct Emitted {
+    char kind;
+    std::vector<float> samples;
+
+    bool operator==(const Emitted&) const = default;
+};
+
+static void record(Sim& sim, std::vector<Emitted>& emitted) {
+    sim.set_physics_callback([&](const std::vector<float>& block) { emitted.push_back({'p', block}); });
+    sim.set_audio_callback([&](const std::vector<float>& block) { emitted.push_back({'a', block}); });
+    sim.set_viz_callback([&](const std::vector<float>& block) { emitted.push_back({'v', block}); });
+}
+
+static SimParams params_for(Integrator integrator) {
+    // Viz samples come every 96 (or with the exact integrator 48) physics samples starting at the first,
+    // so 481 puts one on the last sample of the first physics block, along with the end of a viz block
+    return {
+        .physics_sample_rate = 96000,
+        .physics_block_size = 481,
+        .audio_sample_rate = 48000,
+        .audio_block_size = 256,
+        .viz_sample_rate = 1000,
+        .viz_block_size = 6,
+        .mass = 0.01f,
+        .stiffness = 1e5f,
+        .damping = 0.5f,
+        .area = 1.0f,
+        .integrator = integrator,
+    };
+}
+
+// step_block(n) in chunks of chunk_size must emit exactly what one step() per sample does, block for
+// block and in the same order
+static void check_equivalent(Integrator integrator, int chunk_size, int total) {
+    SimParams params = params_for(integrator);
+    SimState initial{.x = 0.1, .v = 0.0};
+
+    Sim stepped(params, initial);
+    std::vector<Emitted> by_step;
+    record(stepped, by_step);
+    double dt = 1. / stepped.get_params().physics_sample_rate;
+    bool step_ringing = true;
+    for (int i = 0; i < total; i++) {
+        step_ringing = stepped.step(dt);
+    }
+
+    Sim blocked(params, initial);
+    std::vector<Emitted> by_block;
+    record(blocked, by_block);
+    bool block_ringing = true;
+    for (int done = 0; done < total; done += chunk_size) {
+        block_ringing = blocked.step_block(std::min(chunk_size, total - done));
+    }
+
+    const char* name = integrator == Integrator::Exact ? "exact" : "euler";
+    CHECK_MSG(!by_step.empty(), "{} produced no blocks", name);
+    CHECK_MSG(by_step.size() == by_block.size(), "{} chunk {}: {} blocks from step(), {} from step_block()", name,
+              chunk_size, by_step.size(), by_block.size());
+    for (size_t i = 0; i < std::min(by_step.size(), by_block.size()); i++) {
+        if (by_step[i] != by_block[i]) {
+            CHECK_MSG(by_step[i] == by_block[i], "{} chunk {}: block {} differs ('{}' from step(), '{}' from step_block())",
+                      name, chunk_size, i, by_step[i].kind, by_block[i].kind);
+            break;
+        }
+    }
+    CHECK_MSG(step_ringing == block_ringing, "{} chunk {}: still ringing after step() is {}, after step_block() {}",
+              name, chunk_size, step_ringing, block_ringing);
+}
+
+int main() {
+    for (Integrator integrator : {Integrator::SemiImplicitEuler, Integrator::Exact}) {
+        // 97 divides no block size, 1000 spans several physics blocks per call
+        for (int chunk_size : {1, 97, 481, 1000}) {
+            check_equivalent(integrator, chunk_size, 20 * 481 + 123);
+        }
+    }
+    return check_result();
+}
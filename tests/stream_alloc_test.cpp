@@ -0,0 +1,72 @@
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "allocations.h"
+#include "check.h"
+#include "event_stream.h"
+
+// Blocks per pass, a few times around both rings so every slot has been filled and reused
+static constexpr int BLOCKS = 1000;
+
+// Streams blocks through an EventStream the way a sim and a connection do, producer and consumer
+// taking turns on this thread
+static void stream_blocks(EventStream& stream, SampleEncoding encoding,
+                          const std::function<bool(const Event&)>& write_event, const std::vector<float>& audio,
+                          const std::vector<float>& viz) {
+    for (int i = 0; i < BLOCKS; i++) {
+        stream.send(EventType::AudioBlock, audio, i * audio.size(), encoding);
+        stream.send(EventType::VizBlock, viz, i * viz.size(), encoding);
+        if (i % 16 == 0) {
+            stream.send_heartbeat();
+        }
+        // Let events pile up now and then, so the rings wrap with more than one event in them
+        if (i % 4 == 3 || i == BLOCKS - 1) {
+            stream.on_event(write_event);
+        }
+    }
+}
+
+int main() {
+    std::vector<float> audio(512);
+    std::vector<float> viz(64);
+    for (size_t i = 0; i < audio.size(); i++) {
+        audio[i] = 0.5f * std::sin(0.05f * i);
+    }
+    for (size_t i = 0; i < viz.size(); i++) {
+        viz[i] = 0.001f * i;
+    }
+
+    struct Transport {
+        const char* name;
+        void (Event::*encode)(std::string&) const;
+    };
+    for (Transport transport : {Transport{"sse", &Event::write_sse}, Transport{"binary", &Event::write_binary}}) {
+        for (SampleEncoding encoding :
+             {SampleEncoding::F32, SampleEncoding::S16, SampleEncoding::F16, SampleEncoding::Delta}) {
+            // Small rings, so the steady state is reached quickly
+            EventStream stream(16, 8);
+
+            // Writes each event into one reused buffer, built once per connection like main's
+            std::string buffer;
+            size_t written = 0;
+            std::function<bool(const Event&)> write_event = [&, encode = transport.encode](const Event& event) {
+                (event.*encode)(buffer);
+                written += buffer.size();
+                return true;
+            };
+
+            // The first pass sizes every slot's samples and the write buffers
+            stream_blocks(stream, encoding, write_event, audio, viz);
+            uint64_t before = allocation_count();
+            stream_blocks(stream, encoding, write_event, audio, viz);
+            uint64_t allocations = allocation_count() - before;
+
+            CHECK(written > 0);
+            CHECK_MSG(allocations == 0, "{} with encoding {}: {} allocations over {} blocks after warm-up",
+                      transport.name, static_cast<int>(encoding), allocations, BLOCKS);
+        }
+    }
+    return check_result();
+}
@@ -91,6 +91,7 @@ class BonkProcessor extends AudioWorkletProcessor {
           return;
 
         case "buffer":
+          // Samples come decoded, see the audio-block handler in src/main.tsx
           const { start, buffer } = e.data;
           if (start === 0) {
             // Audio callback block start sample number
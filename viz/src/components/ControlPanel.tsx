@@ -1,4 +1,5 @@
 import React, { useState } from "react";
+import type { SampleEncoding } from "../sampleEncoding";
 
 interface ControlPanelProps {
   params: {
@@ -12,6 +13,8 @@ interface ControlPanelProps {
     stiffness: number;
     damping: number;
     area: number;
+    audioEncoding: SampleEncoding;
+    vizEncoding: SampleEncoding;
   };
   setParams: React.Dispatch<React.SetStateAction<ControlPanelProps["params"]>>;
 }
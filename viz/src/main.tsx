@@ -13,6 +13,7 @@ import TopBar from "./components/TopBar";
 import ControlPanel from "./components/ControlPanel";
 import BottomPanel from "./components/BottomPanel";
 import Model from "./components/Model";
+import { decodeSamples, type SampleEncoding } from "./sampleEncoding";
 
 function Wall(props: ThreeElements["mesh"]) {
   return (
@@ -137,22 +138,19 @@ const App: React.FC<AppProps> = ({ bonkWorkletNode }) => {
     // stiffness: 2000,
     damping: 0.1,
     area: 1,
+    // Half the bandwidth of f32, and viz positions barely change between blocks
+    audioEncoding: "s16" as SampleEncoding,
+    vizEncoding: "delta" as SampleEncoding,
   });
   const [bonkProfile, setBonkProfile] = useState<number[]>([]);
   const [audioScope, setAudioScope] = useState<number[]>([]);
 
   setHandler("audio-block", (e) => {
     if (!bonkWorkletNode.current) return;
-    const buffer = new SharedArrayBuffer(params.audioBlockSize * 4);
-    const decodedData = atob(e.data);
-    for (let i = 0; i < decodedData.length; i++) {
-      new DataView(buffer).setUint8(i, decodedData[i].charCodeAt(0));
-    }
+    const bytes = Uint8Array.from(atob(e.data), (c) => c.charCodeAt(0));
     const start = parseInt(e.lastEventId);
-    const message = { event: "buffer", buffer, start };
-    bonkWorkletNode.current.port.postMessage(message);
-
-    const audioData = new Float32Array(buffer);
+    // Decoded once, here, for both the scopes and the worklet
+    const audioData = decodeSamples(bytes, params.audioEncoding);
 
     const profileDownsample = 80;
     const downsampledProfile: number[] = [];
@@ -175,11 +173,15 @@ const App: React.FC<AppProps> = ({ bonkWorkletNode }) => {
       scopeData.push(audioData[i]);
     }
     setAudioScope(scopeData);
+
+    // Transferred last, since that detaches audioData here
+    const message = { event: "buffer", buffer: audioData.buffer, start };
+    bonkWorkletNode.current.port.postMessage(message, [audioData.buffer]);
   });
 
   setHandler("viz-block", (e) => {
     const bytes = Uint8Array.from(atob(e.data), (c) => c.charCodeAt(0));
-    const values = new Float32Array(bytes.buffer);
+    const values = decodeSamples(bytes, params.vizEncoding);
     setState({ ...state, x: values[0] });
   });
 
@@ -0,0 +1,64 @@
+// Mirrors SampleEncoding in src/event_stream.h, all little-endian
+export type SampleEncoding = "f32" | "s16" | "f16" | "delta";
+
+function halfToFloat(half: number): number {
+  const sign = half & 0x8000 ? -1 : 1;
+  const exponent = (half >> 10) & 0x1f;
+  const mantissa = half & 0x3ff;
+  if (exponent === 0) {
+    return sign * mantissa * 2 ** -24;
+  }
+  if (exponent === 0x1f) {
+    return mantissa ? NaN : sign * Infinity;
+  }
+  return sign * (1 + mantissa / 1024) * 2 ** (exponent - 15);
+}
+
+export function decodeSamples(bytes: Uint8Array, encoding: SampleEncoding): Float32Array {
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  switch (encoding) {
+    case "f32": {
+      const samples = new Float32Array(bytes.byteLength / 4);
+      for (let i = 0; i < samples.length; i++) {
+        samples[i] = view.getFloat32(4 * i, true);
+      }
+      return samples;
+    }
+    case "s16": {
+      // A float scale, then one int per sample
+      const scale = view.getFloat32(0, true);
+      const samples = new Float32Array((bytes.byteLength - 4) / 2);
+      for (let i = 0; i < samples.length; i++) {
+        samples[i] = view.getInt16(4 + 2 * i, true) * scale;
+      }
+      return samples;
+    }
+    case "f16": {
+      const samples = new Float32Array(bytes.byteLength / 2);
+      for (let i = 0; i < samples.length; i++) {
+        samples[i] = halfToFloat(view.getUint16(2 * i, true));
+      }
+      return samples;
+    }
+    case "delta": {
+      // Zigzagged varint differences of the float bit patterns, see event_stream.h
+      const bits: number[] = [];
+      let previous = 0;
+      let i = 0;
+      while (i < bytes.length) {
+        let value = 0;
+        let shift = 0;
+        let byte;
+        do {
+          byte = bytes[i++];
+          value += (byte & 0x7f) * 2 ** shift;
+          shift += 7;
+        } while (byte & 0x80);
+        const delta = value % 2 ? -(value + 1) / 2 : value / 2;
+        previous = (previous + delta) >>> 0;
+        bits.push(previous);
+      }
+      return new Float32Array(new Uint32Array(bits).buffer);
+    }
+  }
+}